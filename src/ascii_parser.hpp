@@ -0,0 +1,315 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+#include "misc.hpp"
+
+/****
+ *  Parallel parser of ASCII format using mmap and from_chars
+ */
+namespace ascii_format {
+
+// Read-only view of a vector in flat_vecs
+template <int Flags>
+class vec_view {
+  public:
+    using elem_t = elem_type<Flags>;
+
+    vec_view(const uint32_t* ids, const float* weights, size_t size) : ids_(ids), weights_(weights), size_(size) {}
+
+    size_t size() const {
+        return size_;
+    }
+    elem_t operator[](size_t i) const {
+        if constexpr (is_weighted<Flags>()) {
+            return {ids_[i], weights_[i]};
+        } else {
+            return {ids_[i]};
+        }
+    }
+
+  private:
+    const uint32_t* ids_;
+    const float* weights_;
+    size_t size_;
+};
+
+// Vectors in compressed sparse row format, i.e., the feature IDs and weights of the i-th vector are
+// ids()[offsets()[i]..offsets()[i+1]) and weights()[offsets()[i]..offsets()[i+1]), respectively.
+// If unweighted, weights() returns nullptr.
+template <int Flags>
+class flat_vecs {
+  public:
+    using elem_t = elem_type<Flags>;
+
+    flat_vecs() : offsets_(1, 0) {}
+
+    void clear() {
+        ids_.clear();
+        weights_.clear();
+        offsets_.resize(1);
+    }
+
+    template <class DataVec>
+    void push_back(const DataVec& vec) {
+        for (const elem_t& elem : vec) {
+            push_elem(elem);
+        }
+        close_vec();
+    }
+
+    void push_elem(const elem_t& elem) {
+        ids_.push_back(elem.id());
+        if constexpr (is_weighted<Flags>()) {
+            weights_.push_back(elem.weight());
+        }
+    }
+    // Closes the vector consisting of the elements pushed since the last call
+    void close_vec() {
+        offsets_.push_back(ids_.size());
+    }
+
+    void append(const flat_vecs& other) {
+        const size_t base = ids_.size();
+        ids_.insert(ids_.end(), other.ids_.begin(), other.ids_.end());
+        weights_.insert(weights_.end(), other.weights_.begin(), other.weights_.end());
+        for (size_t i = 1; i < other.offsets_.size(); ++i) {
+            offsets_.push_back(base + other.offsets_[i]);
+        }
+    }
+
+    size_t size() const {
+        return offsets_.size() - 1;
+    }
+    size_t num_elems() const {
+        return ids_.size();
+    }
+    vec_view<Flags> operator[](size_t i) const {
+        return {ids_.data() + offsets_[i], weights() + (is_weighted<Flags>() ? offsets_[i] : 0),
+                offsets_[i + 1] - offsets_[i]};
+    }
+
+    const size_t* offsets() const {
+        return offsets_.data();
+    }
+    const uint32_t* ids() const {
+        return ids_.data();
+    }
+    const float* weights() const {
+        return is_weighted<Flags>() ? weights_.data() : nullptr;
+    }
+
+  private:
+    vector<uint32_t> ids_;
+    vector<float> weights_;
+    vector<size_t> offsets_;
+};
+
+inline bool is_space(char c) {
+    return c == ' ' or c == '\t' or c == '\r' or c == '\v' or c == '\f';
+}
+
+// Parses a line in [beg, end) in the same manner as data_loader::next()
+template <int Flags>
+inline void parse_line(const char* beg, const char* end, uint32_t begin_id, flat_vecs<Flags>& out) {
+    const char* p = beg;
+
+    if constexpr (is_labeled<Flags>()) {
+        p = find(p, end, ' ');
+        p = p == end ? end : p + 1;
+    }
+
+    while (true) {
+        while (p != end and is_space(*p)) {
+            ++p;
+        }
+        if (p == end) {
+            break;
+        }
+        const char* token_end = find_if(p, end, is_space);
+
+        if constexpr (is_weighted<Flags>()) {
+            const char* colon = find(p, token_end, ':');
+            if (colon == token_end) {
+                cerr << "format error\n";
+                exit(1);
+            }
+
+            unsigned long raw_id = 0;
+            if (from_chars(p, colon, raw_id).ec != errc()) {
+                cerr << "format error\n";
+                exit(1);
+            }
+            const char* w = colon + 1;
+            if (w != token_end and *w == '+') {
+                ++w;
+            }
+            float weight = 0.0;
+            if (from_chars(w, token_end, weight).ec != errc()) {
+                cerr << "format error\n";
+                exit(1);
+            }
+
+            auto id = static_cast<uint32_t>(raw_id) - begin_id;
+            if constexpr (is_generalized<Flags>()) {
+                if (weight > 0) {
+                    id = id * 2;
+                } else {
+                    id = id * 2 + 1;
+                    weight = -1 * weight;
+                }
+            } else {
+                if (weight < 0) {
+                    cerr << "need GENERALIZED\n";
+                    exit(1);
+                }
+            }
+            out.push_elem({id, weight});
+        } else {
+            uint32_t id = 0;
+            if (from_chars(p, token_end, id).ec != errc()) {
+                break;
+            }
+            out.push_elem({id});
+        }
+        p = token_end;
+    }
+
+    out.close_vec();
+}
+
+// Maps an input file to be parsed in parallel, which cannot be the standard input or compressed
+inline mmap_file map_input(const string& fn) {
+    if (!is_seekable(fn)) {
+        cerr << "error: the standard input or compressed files cannot be parsed in parallel" << endl;
+        exit(1);
+    }
+    return mmap_file(fn);
+}
+
+// Loads vectors chunk by chunk from a memory-mapped file,
+// where each chunk is split at newlines and parsed by multiple threads
+// (num_threads of them, or as many as the OpenMP threads if zero)
+template <int Flags>
+class parallel_loader {
+  public:
+    static constexpr size_t DEFAULT_CHUNK_BYTES = size_t(1) << 26;
+
+    parallel_loader() = default;
+
+    // Only the lines beginning in the byte range of the shard are loaded
+    parallel_loader(const string& fn, uint32_t begin_id, shard_t shard = {}, size_t num_threads = 0,
+                    size_t chunk_bytes = DEFAULT_CHUNK_BYTES)
+        : file_(map_input(fn)), begin_id_(begin_id), num_threads_(num_threads), chunk_bytes_(chunk_bytes) {
+        file_.advise_sequential();
+        const size_t beg = shard.begin(file_.size());
+        const size_t end = shard.end(file_.size());
+        pos_ = beg == 0 ? 0 : find_line_end(beg - 1);
+        end_ = end == 0 ? 0 : find_line_end(end - 1);
+    }
+
+    // Parses the vectors of the next chunk into vecs, returning false at the end of the file
+    bool next(flat_vecs<Flags>& vecs) {
+        vecs.clear();
+
+        const char* data = file_.data();
+        if (pos_ >= end_) {
+            return false;
+        }
+
+        auto start_tp = chrono::system_clock::now();
+
+        const size_t chunk_end = pos_ + chunk_bytes_ >= end_ ? end_ : find_line_end(pos_ + chunk_bytes_);
+        const size_t num_threads = num_threads_ != 0 ? num_threads_ : static_cast<size_t>(omp_get_max_threads());
+        const size_t num_parts = num_threads * 4;
+        const size_t part_bytes = (chunk_end - pos_ + num_parts - 1) / num_parts;
+
+        if (parts_.size() < num_parts) {
+            parts_.resize(num_parts);
+        }
+
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+        for (size_t k = 0; k < num_parts; ++k) {
+            flat_vecs<Flags>& part = parts_[k];
+            part.clear();
+
+            // Each part consists of the lines beginning in [pos_ + k * part_bytes, pos_ + (k + 1) * part_bytes)
+            size_t beg = to_line_begin(min(pos_ + k * part_bytes, chunk_end));
+            size_t end = to_line_begin(min(pos_ + (k + 1) * part_bytes, chunk_end));
+
+            while (beg < end) {
+                const char* line_end = static_cast<const char*>(memchr(data + beg, '\n', end - beg));
+                if (line_end == nullptr) {
+                    line_end = data + end;
+                }
+                parse_line<Flags>(data + beg, line_end, begin_id_, part);
+                beg = static_cast<size_t>(line_end - data) + 1;
+            }
+        }
+
+        for (size_t k = 0; k < num_parts; ++k) {
+            vecs.append(parts_[k]);
+        }
+
+        parsed_bytes_ += chunk_end - pos_;
+        pos_ = chunk_end;
+        parse_sec_ += chrono::duration<double>(chrono::system_clock::now() - start_tp).count();
+        return true;
+    }
+
+    double parsed_MiB() const {
+        return parsed_bytes_ / (1024.0 * 1024.0);
+    }
+    double parse_MiB_per_sec() const {
+        return parse_sec_ == 0.0 ? 0.0 : parsed_MiB() / parse_sec_;
+    }
+
+  private:
+    mmap_file file_;
+    uint32_t begin_id_ = 0;
+    size_t num_threads_ = 0;
+    size_t chunk_bytes_ = DEFAULT_CHUNK_BYTES;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    vector<flat_vecs<Flags>> parts_;
+
+    size_t parsed_bytes_ = 0;
+    double parse_sec_ = 0.0;
+
+    // Returns the beginning of the first line starting at or after pos
+    size_t to_line_begin(size_t pos) const {
+        return pos == pos_ ? pos : find_line_end(pos - 1);
+    }
+
+    // Returns the position next to the newline at or after pos, or the file size
+    size_t find_line_end(size_t pos) const {
+        const size_t size = file_.size();
+        if (pos >= size) {
+            return size;
+        }
+        const void* nl = memchr(file_.data() + pos, '\n', size - pos);
+        return nl == nullptr ? size : static_cast<size_t>(static_cast<const char*>(nl) - file_.data()) + 1;
+    }
+};
+
+template <int Flags>
+inline flat_vecs<Flags> load_flat_vecs(const string& fn, uint32_t begin_id, bool parallel) {
+    flat_vecs<Flags> vecs;
+    if (parallel) {
+        parallel_loader<Flags> loader(fn, begin_id);
+        for (flat_vecs<Flags> chunk; loader.next(chunk);) {
+            vecs.append(chunk);
+        }
+        cout << "Parsed " << loader.parsed_MiB() << " MiB at " << loader.parse_MiB_per_sec() << " MiB/s" << endl;
+    } else {
+        data_loader<Flags> loader(fn, begin_id);
+        while (loader.next()) {
+            vecs.push_back(loader.get());
+        }
+    }
+    return vecs;
+}
+
+}  // namespace ascii_format
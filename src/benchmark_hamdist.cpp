@@ -0,0 +1,88 @@
+#include <chrono>
+
+#include "cmdline.h"
+#include "hamdist_simd.hpp"
+#include "misc.hpp"
+
+// Sums the mismatches between every pair of the database and the queries
+template <class Kernel>
+uint64_t scan(const vector<uint8_t>& codes, const vector<uint8_t>& queries, size_t dim, Kernel&& kernel) {
+    const size_t N = codes.size() / dim;
+    const size_t M = queries.size() / dim;
+    uint64_t sum = 0;
+    for (size_t j = 0; j < M; ++j) {
+        const uint8_t* q = &queries[j * dim];
+        for (size_t i = 0; i < N; ++i) {
+            sum += kernel(&codes[i * dim], q);
+        }
+    }
+    return sum;
+}
+
+// Scans random sketches of 8-bit samples with the kernel of each instruction set supported by the CPU,
+// reporting the time per comparison and checking that the kernels count the same mismatches
+int main(int argc, char** argv) {
+    ios::sync_with_stdio(false);
+
+    cmdline::parser p;
+    p.add<string>("dims", 'D', "comma-separated dimensions of sketches", false, "32,64,128,256,100");
+    p.add<size_t>("num_codes", 'n', "number of database sketches", false, 100000);
+    p.add<size_t>("num_queries", 'm', "number of queries", false, 100);
+    p.add<uint32_t>("bits", 'b', "bits of random samples, where fewer bits make more samples equal", false, 2);
+    p.add<size_t>("seed", 's', "seed for random sketches", false, 114514);
+    p.parse_check(argc, argv);
+
+    auto num_codes = p.get<size_t>("num_codes");
+    auto num_queries = p.get<size_t>("num_queries");
+    auto bits = p.get<uint32_t>("bits");
+    auto seed = p.get<size_t>("seed");
+
+    if (bits == 0 or bits > 8) {
+        cerr << "error: bits must be in [1, 8]" << endl;
+        return 1;
+    }
+
+    const simd_level supported = detect_simd_level();
+    cout << "Supported SIMD instruction set: " << get_simd_name(supported) << endl;
+
+    istringstream dims_iss(p.get<string>("dims"));
+    for (string dim_str; getline(dims_iss, dim_str, ',');) {
+        const uint32_t dim = static_cast<uint32_t>(stoul(dim_str));
+
+        mt19937_64 engine(seed);
+        uniform_int_distribution<uint32_t> dist(0, (1u << bits) - 1);
+        vector<uint8_t> codes(num_codes * dim);
+        vector<uint8_t> queries(num_queries * dim);
+        for (uint8_t& v : codes) {
+            v = static_cast<uint8_t>(dist(engine));
+        }
+        for (uint8_t& v : queries) {
+            v = static_cast<uint8_t>(dist(engine));
+        }
+
+        cout << "== D=" << dim << " ==" << endl;
+        double scalar_ns = 0.0;
+        uint64_t scalar_sum = 0;
+
+        for (int l = 0; l <= static_cast<int>(supported); ++l) {
+            const auto level = static_cast<simd_level>(l);
+            auto start_tp = chrono::system_clock::now();
+            const uint64_t sum =
+                hamdist::dispatch(level, dim, [&](auto kernel) { return scan(codes, queries, dim, kernel); });
+            const double ns = chrono::duration<double, nano>(chrono::system_clock::now() - start_tp).count() /
+                              (double(num_codes) * num_queries);
+            if (level == simd_level::scalar) {
+                scalar_ns = ns;
+                scalar_sum = sum;
+            }
+            cout << get_simd_name(level) << ": " << ns << " ns/cmp, " << dim / ns << " GB/s of database, "
+                 << scalar_ns / ns << "x of scalar" << endl;
+            if (sum != scalar_sum) {
+                cerr << "error: " << get_simd_name(level) << " counts mismatches differently from scalar" << endl;
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include <chrono>
+
+#include "ascii_parser.hpp"
+#include "cmdline.h"
+#include "misc.hpp"
+#include "sketcher.hpp"
+
+using namespace ascii_format;
+
+struct error_stats {
+    double sq_err = 0.0;
+    double err = 0.0;
+    size_t num = 0;
+
+    void add(double est, double sim) {
+        sq_err += (est - sim) * (est - sim);
+        err += est - sim;
+        num += 1;
+    }
+    double rmse() const {
+        return num == 0 ? 0.0 : sqrt(sq_err / num);
+    }
+    double bias() const {
+        return num == 0 ? 0.0 : err / num;
+    }
+};
+
+template <int Flags>
+int run(const cmdline::parser& p) {
+    auto input_fn = p.get<string>("input_fn");
+    auto dat_dim = p.get<size_t>("dat_dim");
+    auto cws_dim = p.get<size_t>("cws_dim");
+    auto begin_id = p.get<uint32_t>("begin_id");
+    auto seed = p.get<size_t>("seed");
+    auto num_pairs = p.get<size_t>("num_pairs");
+    auto min_sim = p.get<float>("min_sim");
+    auto parallel_parse = p.get<bool>("parallel_parse");
+    auto methods_str = p.get<string>("methods");
+
+    const auto vecs = load_flat_vecs<Flags>(input_fn, begin_id, parallel_parse);
+    const size_t N = vecs.size();
+    if (N < 2) {
+        cerr << "error: at least two input vectors are needed" << endl;
+        return 1;
+    }
+
+    if (dat_dim == 0) {
+        for (size_t k = 0; k < vecs.offsets()[N]; ++k) {
+            dat_dim = max<size_t>(dat_dim, vecs.ids()[k] + size_t(1));
+        }
+    } else if (is_generalized<Flags>()) {
+        dat_dim *= 2;
+    }
+    cout << N << " vecs of " << vecs.offsets()[N] / double(N) << " nonzero features on average (dat_dim=" << dat_dim
+         << ")" << endl;
+
+    // Random pairs of different vectors, whose exact similarities are computed once
+    struct pair_t {
+        uint32_t x;
+        uint32_t y;
+        float sim;
+    };
+    vector<pair_t> pairs(num_pairs);
+    {
+        mt19937_64 engine(seed);
+        uniform_int_distribution<size_t> dist(0, N - 1);
+        for (pair_t& pair : pairs) {
+            do {
+                pair.x = uint32_t(dist(engine));
+                pair.y = uint32_t(dist(engine));
+            } while (pair.x == pair.y);
+        }
+    }
+#pragma omp parallel for
+    for (size_t k = 0; k < num_pairs; ++k) {
+        pairs[k].sim = calc_minmax_sim<Flags>(vecs[pairs[k].x], vecs[pairs[k].y]);
+    }
+
+    // Each of the methods with each layout of random matrix data
+    struct method_t {
+        cws::method_type method;
+        cws::matrix_type type;
+    };
+    vector<method_t> methods;
+    istringstream methods_iss(methods_str);
+    for (string name; getline(methods_iss, name, ',');) {
+        const cws::method_type method = cws::parse_method(name);
+        if (method == cws::method_type::dart_minhash) {
+            methods.push_back({method, cws::matrix_type::matrix_free});
+            continue;
+        }
+        for (auto type : {cws::matrix_type::sample_major, cws::matrix_type::feature_major,
+                          cws::matrix_type::matrix_free}) {
+            methods.push_back({method, type});
+        }
+    }
+    const char* type_names[] = {"sample-major", "feature-major", "matrix-free"};
+
+    vector<uint32_t> min_ids(N * cws_dim);
+
+    for (const method_t& m : methods) {
+        cout << "== " << cws::get_method_name(m.method);
+        if (m.method != cws::method_type::dart_minhash) {
+            cout << " (" << type_names[static_cast<int>(m.type)] << ")";
+        }
+        cout << " ==" << endl;
+
+        auto start_tp = chrono::system_clock::now();
+        const cws::sketcher sketcher(dat_dim, cws_dim, seed, m.type, m.method);
+        auto gen_cnt = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now() - start_tp).count();
+
+        start_tp = chrono::system_clock::now();
+        sketcher.sketch_sparse(N, vecs.offsets(), vecs.ids(), vecs.weights(), min_ids.data());
+        auto dur_cnt = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now() - start_tp).count();
+
+        cout << "Generation: " << gen_cnt << "ms" << endl;
+        cout << "Sampling: " << dur_cnt << "ms (" << N / max(dur_cnt * 1e-3, 1e-3) << " vecs/s)" << endl;
+
+        // The fraction of equal samples estimates the similarity
+        error_stats all, similar;
+        for (const pair_t& pair : pairs) {
+            const uint32_t* x = &min_ids[pair.x * cws_dim];
+            const uint32_t* y = &min_ids[pair.y * cws_dim];
+            size_t matches = 0;
+            for (size_t i = 0; i < cws_dim; ++i) {
+                matches += x[i] == y[i];
+            }
+            const double est = double(matches) / cws_dim;
+            all.add(est, pair.sim);
+            if (pair.sim >= min_sim) {
+                similar.add(est, pair.sim);
+            }
+        }
+        cout << "RMSE: " << all.rmse() << " (bias " << all.bias() << ") over " << all.num << " pairs" << endl;
+        cout << "RMSE: " << similar.rmse() << " (bias " << similar.bias() << ") over " << similar.num
+             << " pairs of similarity >= " << min_sim << endl;
+    }
+
+    return 0;
+}
+
+template <int Flags = 0>
+int run_with_flags(int flags, const cmdline::parser& p) {
+    if constexpr (Flags > FLAGS_MAX) {
+        cerr << "Error: invalid flags\n";
+        return 1;
+    } else {
+        if (flags == Flags) {
+            return run<Flags>(p);
+        }
+        return run_with_flags<Flags + 1>(flags, p);
+    }
+}
+
+int main(int argc, char** argv) {
+    ios::sync_with_stdio(false);
+    cout << "num threads: " << omp_get_max_threads() << endl;
+
+    cmdline::parser p;
+    p.add<string>("input_fn", 'i', "input file name of database vectors (in ASCII format)", true);
+    p.add<size_t>("dat_dim", 'd', "dimension of the input data (if 0, the maximum feature ID + 1)", false, 0);
+    p.add<size_t>("cws_dim", 'D', "dimension of the CWS-sketches", false, 64);
+    p.add<uint32_t>("begin_id", 'b', "beginning ID of data column", false, 0);
+    p.add<bool>("weighted", 'w', "Does the input data have weight?", false, false);
+    p.add<bool>("generalized", 'g', "Does the input data need to be generalized?", false, false);
+    p.add<bool>("labeled", 'l', "Does each input vector have a label at the head?", false, false);
+    p.add<size_t>("seed", 's', "seed for random matrix data and pairs", false, 114514);
+    p.add<size_t>("num_pairs", 'n', "number of random pairs to evaluate the estimation error", false, 100000);
+    p.add<float>("min_sim", 't', "similarity from which pairs are also evaluated separately", false, 0.1);
+    p.add<string>("methods", 'a', "comma-separated sampling methods (icws/pcws/i2cws/dart)", false,
+                  "icws,pcws,i2cws,dart");
+    p.add<bool>("parallel_parse", 'P', "Parse the input file in parallel via mmap?", false, false);
+    p.parse_check(argc, argv);
+
+    auto weighted = p.get<bool>("weighted");
+    auto generalized = p.get<bool>("generalized");
+    auto labeled = p.get<bool>("labeled");
+
+    auto flags = make_flags(weighted, generalized, labeled);
+    return run_with_flags(flags, p);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/****
+ *  Bit-sliced layout of sketches with samples of few bits
+ *
+ *  The b lowest bits of the samples are stored as b bit-planes of 64 samples per word,
+ *  where the planes of each 64 samples are adjacent, i.e., word (w * b + p) holds bit p of
+ *  samples [64w, 64w + 64). Two samples mismatch if any of their planes differ, so the mismatches
+ *  of 64 samples are counted by popcount on the OR of XORs across the planes.
+ *  A sketch of D samples takes b * ceil(D / 64) words instead of D bytes or more.
+ */
+namespace bit_planes {
+
+inline size_t get_words_per_plane(size_t dim) {
+    return (dim + 63) / 64;
+}
+
+inline size_t get_record_words(size_t dim, uint32_t bits) {
+    return get_words_per_plane(dim) * bits;
+}
+
+// Slices the lowest bits of dim samples into a record of get_record_words(dim, bits) words
+template <class SampleType>
+inline void slice(const SampleType* samples, size_t dim, uint32_t bits, uint64_t* record) {
+    std::fill(record, record + get_record_words(dim, bits), 0);
+    for (size_t i = 0; i < dim; ++i) {
+        uint64_t* words = &record[i / 64 * bits];
+        for (uint32_t p = 0; p < bits; ++p) {
+            words[p] |= uint64_t((samples[i] >> p) & 1) << (i % 64);
+        }
+    }
+}
+
+// Slices num_vecs sketches of dim samples into consecutive records
+template <class SampleType>
+inline void slice_all(const SampleType* codes, size_t num_vecs, size_t dim, uint32_t bits, uint64_t* records) {
+    const size_t record_words = get_record_words(dim, bits);
+#pragma omp parallel for
+    for (size_t i = 0; i < num_vecs; ++i) {
+        slice(&codes[i * dim], dim, bits, &records[i * record_words]);
+    }
+}
+
+// Kernel counting mismatches between records of Bits planes of Words words
+// (or of bits planes of words words at runtime if zero), whose loops are unrolled if fixed
+template <uint32_t Bits, uint32_t Words>
+struct kernel {
+    uint32_t bits;
+    uint32_t words;
+
+    uint32_t operator()(const uint64_t* x, const uint64_t* y) const {
+        const uint32_t b = Bits != 0 ? Bits : bits;
+        const uint32_t n = Words != 0 ? Words : words;
+        uint32_t errs = 0;
+        for (uint32_t w = 0; w < n; ++w) {
+            uint64_t f = 0;
+            for (uint32_t p = 0; p < b; ++p) {
+                f |= x[w * b + p] ^ y[w * b + p];
+            }
+            errs += static_cast<uint32_t>(__builtin_popcountll(f));
+        }
+        return errs;
+    }
+};
+
+template <uint32_t Bits, class Fn>
+inline auto dispatch_words(uint32_t bits, uint32_t words, Fn&& fn) {
+    switch (words) {
+        case 1:
+            return fn(kernel<Bits, 1>{bits, words});
+        case 2:
+            return fn(kernel<Bits, 2>{bits, words});
+        case 4:
+            return fn(kernel<Bits, 4>{bits, words});
+        default:
+            return fn(kernel<Bits, 0>{bits, words});
+    }
+}
+
+// Calls fn with the kernel specialized for bits of 1 to 4 and sketches of 64/128/256 samples
+template <class Fn>
+inline auto dispatch(uint32_t bits, size_t dim, Fn&& fn) {
+    const uint32_t words = static_cast<uint32_t>(get_words_per_plane(dim));
+    switch (bits) {
+        case 1:
+            return dispatch_words<1>(bits, words, fn);
+        case 2:
+            return dispatch_words<2>(bits, words, fn);
+        case 3:
+            return dispatch_words<3>(bits, words, fn);
+        case 4:
+            return dispatch_words<4>(bits, words, fn);
+        default:
+            return dispatch_words<0>(bits, words, fn);
+    }
+}
+
+}  // namespace bit_planes
@@ -0,0 +1,91 @@
+#include "cmdline.h"
+#include "misc.hpp"
+#include "sketch_format.hpp"
+
+// Concatenates packed sketches of the same settings, fixing the number of vectors in the header
+int concat_packed(const vector<string>& input_fns, const string& output_fn) {
+    vector<sketch_format::mapped_sketches> parts;
+    for (const string& input_fn : input_fns) {
+        parts.emplace_back(input_fn);
+    }
+
+    sketch_format::header_t header = parts[0].header();
+    for (size_t k = 1; k < parts.size(); ++k) {
+        const sketch_format::header_t& h = parts[k].header();
+        if (h.cws_dim != header.cws_dim or h.bits != header.bits or h.flags != header.flags or
+            h.seed != header.seed or h.first_sample != header.first_sample or h.total_dim != header.total_dim) {
+            cerr << "error: " << input_fns[k] << " is sketched with settings different from " << input_fns[0]
+                 << endl;
+            return 1;
+        }
+        header.num_vecs += h.num_vecs;
+    }
+
+    auto out = make_ofstream(output_fn);
+    write_value(out, header);
+    for (const auto& part : parts) {
+        write_vec(out, reinterpret_cast<const char*>(part.record(0)), part.size() * header.record_bytes);
+    }
+    out.flush();
+    return 0;
+}
+
+// Concatenates sketches (or hash values) in the texmex-like format, which have no header
+int concat_vecs(const vector<string>& input_fns, const string& output_fn) {
+    auto out = make_ofstream(output_fn);
+    for (const string& input_fn : input_fns) {
+        mmap_file part(input_fn);
+        part.advise_sequential();
+        write_vec(out, part.data(), part.size());
+    }
+    out.flush();
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    ios::sync_with_stdio(false);
+
+    cmdline::parser p;
+    p.add<string>("input_fns", 'i',
+                  "comma-separated input file names of CWS-sketches (in bvecs/svecs/ivecs/fvecs or cws format), "
+                  "in the order of the shards",
+                  true);
+    p.add<string>("output_fn", 'o', "output file name of the concatenated CWS-sketches (without the extension)",
+                  true);
+    p.parse_check(argc, argv);
+
+    auto output_fn = p.get<string>("output_fn");
+
+    vector<string> input_fns;
+    istringstream input_iss(p.get<string>("input_fns"));
+    for (string input_fn; getline(input_iss, input_fn, ',');) {
+        input_fns.push_back(input_fn);
+    }
+    if (input_fns.empty()) {
+        cerr << "error: no input files" << endl;
+        return 1;
+    }
+
+    const string ext = get_ext(input_fns[0]);
+    for (const string& input_fn : input_fns) {
+        if (get_ext(input_fn) != ext) {
+            cerr << "error: " << input_fn << " differs in the format from " << input_fns[0] << endl;
+            return 1;
+        }
+    }
+    output_fn += "." + ext;
+
+    int ret = 0;
+    if (ext == "cws") {
+        ret = concat_packed(input_fns, output_fn);
+    } else if (ext == "bvecs" or ext == "svecs" or ext == "ivecs" or ext == "fvecs") {
+        ret = concat_vecs(input_fns, output_fn);
+    } else {
+        cerr << "error: invalid extension" << endl;
+        return 1;
+    }
+    if (ret == 0) {
+        cout << "Output " << output_fn << " of " << input_fns.size() << " files" << endl;
+    }
+    return ret;
+}
@@ -0,0 +1,523 @@
+#pragma once
+
+#include "misc.hpp"
+#include "splitmix.hpp"
+
+/****
+ *  Random data and sampling kernels of consistent weighted sampling
+ */
+namespace cws {
+
+// Random parameters of the (i,j)-th cell, i.e., for the i-th sample and the j-th feature
+struct params_t {
+    float r;      // ~ Gamma(2,1)
+    float log_c;  // log10(c) for c ~ Gamma(2,1)
+    float b;      // ~ Uniform(0,1)
+};
+
+// Distributions of the random parameters, sharing the kernel a = log_c - r * (t + 1 - b)
+enum class param_type : int {
+    icws = 0,  // Improved CWS (Ioffe, 2010)
+    pcws = 1,  // Practical CWS (Wu et al., 2017), drawing four uniform values instead of two gamma ones,
+               // where log_c = log10(-ln(x) * u1) + r for r = -ln(u1 * u2) absorbs the different kernel
+};
+
+// Uniform in (0,1] from the highest 53 bits
+inline double to_open_unit(uint64_t x) {
+    return double((x >> 11) + 1) * 0x1.0p-53;
+}
+// Uniform in [0,1) from the highest 24 bits, matching the precision of float
+inline double to_closed_unit(uint64_t x) {
+    return double(x >> 40) * 0x1.0p-24;
+}
+
+// Draws the parameters from uniform values of next()
+template <class Next>
+inline params_t draw_params(param_type type, Next&& next) {
+    const double u1 = to_open_unit(next());
+    const double u2 = to_open_unit(next());
+    const double r = -log(u1 * u2);
+    if (type == param_type::pcws) {
+        const double x = to_open_unit(next());
+        const double b = to_closed_unit(next());
+        return {static_cast<float>(r), static_cast<float>(log10(-log(x) * u1) + r), static_cast<float>(b)};
+    }
+    const double c = -log(to_open_unit(next()) * to_open_unit(next()));
+    const double b = to_closed_unit(next());
+    return {static_cast<float>(r), log10(static_cast<float>(c)), static_cast<float>(b)};
+}
+
+// Random parameters stored in three dense matrices of (cws_dim * dat_dim) cells,
+// where log10(c) is precomputed to avoid evaluating it in every sampling.
+// The matrices are generated from the seed, or viewed in a mapped model file (see cws_model.hpp).
+class random_matrix {
+  public:
+    random_matrix() = default;
+
+    random_matrix(size_t dat_dim, size_t cws_dim, size_t seed, param_type type = param_type::icws)
+        : dat_dim_(dat_dim), cws_dim_(cws_dim), seed_(seed), buffer_(3 * dat_dim * cws_dim) {
+        set_rows(buffer_.data());
+
+        const size_t size = dat_dim * cws_dim;
+        float* R = buffer_.data();
+        float* logC = R + size;
+        float* B = logC + size;
+
+        splitmix64 seeder(seed);
+
+        if (type != param_type::icws) {
+            // All the parameters of each cell from one engine
+            for_each_random_block(size, seeder.next(), [&](mt19937_64& engine, size_t beg, size_t end) {
+                for (size_t pos = beg; pos < end; ++pos) {
+                    const params_t prm = draw_params(type, engine);
+                    R[pos] = prm.r;
+                    logC[pos] = prm.log_c;
+                    B[pos] = prm.b;
+                }
+            });
+            return;
+        }
+
+        const size_t seed_R = seeder.next();
+        const size_t seed_C = seeder.next();
+        const size_t seed_B = seeder.next();
+
+        // Each matrix is generated by all the threads
+        generate_random_matrix(gamma_t(2.0, 1.0), R, size, seed_R);
+        generate_random_matrix(gamma_t(2.0, 1.0), logC, size, seed_C);
+        generate_random_matrix(uniform_t(0.0, 1.0), B, size, seed_B);
+
+#pragma omp parallel for
+        for (size_t pos = 0; pos < size; ++pos) {
+            logC[pos] = log10(logC[pos]);
+        }
+    }
+
+    // Views the matrices R, log10(C) and B stored consecutively from the offset of the mapped file
+    random_matrix(size_t dat_dim, size_t cws_dim, size_t seed, mmap_file&& file, size_t offset)
+        : dat_dim_(dat_dim), cws_dim_(cws_dim), seed_(seed), file_(move(file)) {
+        set_rows(reinterpret_cast<const float*>(file_.data() + offset));
+    }
+
+    // The rows point to the buffer or the mapped file
+    random_matrix(const random_matrix&) = delete;
+    random_matrix& operator=(const random_matrix&) = delete;
+    random_matrix(random_matrix&&) = default;
+    random_matrix& operator=(random_matrix&&) = default;
+
+    params_t operator()(size_t i, size_t j) const {
+        const size_t pos = i * dat_dim_ + j;
+        return {R_[pos], logC_[pos], B_[pos]};
+    }
+
+    // Returns the rows of the i-th sample, i.e., the parameters for all the features
+    const float* r_row(size_t i) const {
+        return &R_[i * dat_dim_];
+    }
+    const float* log_c_row(size_t i) const {
+        return &logC_[i * dat_dim_];
+    }
+    const float* b_row(size_t i) const {
+        return &B_[i * dat_dim_];
+    }
+
+    // Feature IDs must be less than this value
+    size_t dat_dim() const {
+        return dat_dim_;
+    }
+
+    size_t cws_dim() const {
+        return cws_dim_;
+    }
+
+    size_t seed() const {
+        return seed_;
+    }
+
+    size_t memory_in_bytes() const {
+        return sizeof(float) * 3 * dat_dim_ * cws_dim_;
+    }
+
+  private:
+    size_t dat_dim_ = 0;
+    size_t cws_dim_ = 0;
+    size_t seed_ = 0;
+    vector<float> buffer_;
+    mmap_file file_;
+    const float* R_ = nullptr;
+    const float* logC_ = nullptr;
+    const float* B_ = nullptr;
+
+    void set_rows(const float* data) {
+        R_ = data;
+        logC_ = R_ + dat_dim_ * cws_dim_;
+        B_ = logC_ + dat_dim_ * cws_dim_;
+    }
+};
+
+// Random parameters derived on the fly from a counter-based generator keyed by (seed, i, j),
+// so no memory is consumed and feature IDs are not bounded.
+// Note that the parameters are different from those of random_matrix with the same seed.
+class hashed_matrix {
+  public:
+    hashed_matrix() = default;
+
+    explicit hashed_matrix(size_t seed, param_type type = param_type::icws)
+        : seed_(seed), key_(splitmix64::mix(seed)), type_(type) {}
+
+    params_t operator()(size_t i, size_t j) const {
+        splitmix64 gen(splitmix64::mix(key_ ^ ((uint64_t(i) << 32) | uint64_t(j & UINT32_MAX))));
+        return draw_params(type_, [&]() { return gen.next(); });
+    }
+
+    size_t dat_dim() const {
+        return numeric_limits<size_t>::max();
+    }
+
+    size_t seed() const {
+        return seed_;
+    }
+
+    size_t memory_in_bytes() const {
+        return 0;
+    }
+
+  private:
+    size_t seed_ = 0;
+    uint64_t key_ = 0;
+    param_type type_ = param_type::icws;
+};
+
+// Darts of DartMinHash (Christiani, 2020), i.e., points (v, r) of a Poisson process of unit rate thrown onto
+// [0, weight) x [0, theta) of each feature, where the first dart (of the least rank r) of each sample hits
+// a feature with probability proportional to its weight. Thus, two vectors share the sample with probability
+// equal to their weighted Jaccard similarity, as with ICWS, but in O(nnz log(weight range) + cws_dim log cws_dim)
+// time instead of O(nnz * cws_dim) since each dart is assigned to one of the samples.
+// The darts are derived on the fly from the seed, so no memory is consumed and feature IDs are not bounded.
+class dart_minhash {
+  public:
+    // Expected number of darts in a weight interval below which it and the lower ones are skipped
+    // (a tiny loss of consistency close to the precision of float)
+    static constexpr double MIN_DARTS = 0x1.0p-24;
+
+    dart_minhash() = default;
+
+    explicit dart_minhash(size_t seed) : seed_(seed), key_(splitmix64::mix(seed + 1)) {}
+
+    // Generator of the darts of the j-th feature whose weights v are in the interval [2^e, 2^(e+1)),
+    // in increasing order of ranks with exponential gaps of rate 2^e, each drawing three values:
+    // the gap, v and the sample.
+    splitmix64 darts(uint32_t j, int e) const {
+        return splitmix64(splitmix64::mix(key_ ^ ((uint64_t(j) << 16) | uint64_t(uint16_t(e)))));
+    }
+
+    size_t dat_dim() const {
+        return numeric_limits<size_t>::max();
+    }
+
+    size_t seed() const {
+        return seed_;
+    }
+
+    size_t memory_in_bytes() const {
+        return 0;
+    }
+
+  private:
+    size_t seed_ = 0;
+    uint64_t key_ = 0;
+};
+
+// Second random parameters (r1, b1) of I2CWS (Wu et al., 2019), independent of those choosing the feature,
+// which quantize the weight of the sampled feature into t. Since they are needed only for cws_dim features
+// per vector, they are derived on the fly from the seed.
+class i2cws_params {
+  public:
+    i2cws_params() = default;
+
+    explicit i2cws_params(size_t seed) : key_(splitmix64::mix(seed + 2)) {}
+
+    // Returns the full sample (j, t) of the i-th sample hashed into 32 bits, for the sampled feature j of the weight
+    uint32_t operator()(size_t i, uint32_t j, float weight) const {
+        splitmix64 gen(splitmix64::mix(key_ ^ ((uint64_t(i) << 32) | uint64_t(j))));
+        const double r = -log(to_open_unit(gen.next()) * to_open_unit(gen.next()));
+        const double b = to_closed_unit(gen.next());
+        const int32_t t = weight > 0.0f ? static_cast<int32_t>(floor(log10(weight) / r + b)) : 0;
+        return static_cast<uint32_t>(splitmix64::mix((uint64_t(j) << 32) | uint32_t(t)) >> 32);
+    }
+
+  private:
+    uint64_t key_ = 0;
+};
+
+// Random parameters stored in feature-major order, i.e., the parameters of all the samples for
+// a feature are interleaved in a contiguous block.
+// The parameters are the same as those of random_matrix with the same seed.
+class feature_major_matrix {
+  public:
+    struct cell_t {
+        float r;
+        float log_c;
+        float b;
+    };
+
+    feature_major_matrix() = default;
+
+    // Transposes random_matrix, consuming twice its memory at peak
+    feature_major_matrix(size_t dat_dim, size_t cws_dim, size_t seed, param_type type = param_type::icws)
+        : dat_dim_(dat_dim), cws_dim_(cws_dim), seed_(seed), buffer_(dat_dim * cws_dim) {
+        cells_ = buffer_.data();
+
+        random_matrix mat(dat_dim, cws_dim, seed, type);
+
+#pragma omp parallel for
+        for (size_t j = 0; j < dat_dim; ++j) {
+            cell_t* cells = &buffer_[j * cws_dim];
+            for (size_t i = 0; i < cws_dim; ++i) {
+                const params_t prm = mat(i, j);
+                cells[i] = {prm.r, prm.log_c, prm.b};
+            }
+        }
+    }
+
+    // Views the cells stored from the offset of the mapped file
+    feature_major_matrix(size_t dat_dim, size_t cws_dim, size_t seed, mmap_file&& file, size_t offset)
+        : dat_dim_(dat_dim), cws_dim_(cws_dim), seed_(seed), file_(move(file)) {
+        cells_ = reinterpret_cast<const cell_t*>(file_.data() + offset);
+    }
+
+    // The cells point to the buffer or the mapped file
+    feature_major_matrix(const feature_major_matrix&) = delete;
+    feature_major_matrix& operator=(const feature_major_matrix&) = delete;
+    feature_major_matrix(feature_major_matrix&&) = default;
+    feature_major_matrix& operator=(feature_major_matrix&&) = default;
+
+    // Returns the cws_dim cells of the j-th feature
+    const cell_t* feature(size_t j) const {
+        return &cells_[j * cws_dim_];
+    }
+
+    size_t dat_dim() const {
+        return dat_dim_;
+    }
+
+    size_t cws_dim() const {
+        return cws_dim_;
+    }
+
+    size_t seed() const {
+        return seed_;
+    }
+
+    size_t memory_in_bytes() const {
+        return sizeof(cell_t) * dat_dim_ * cws_dim_;
+    }
+
+  private:
+    size_t dat_dim_ = 0;
+    size_t cws_dim_ = 0;
+    size_t seed_ = 0;
+    vector<cell_t> buffer_;
+    mmap_file file_;
+    const cell_t* cells_ = nullptr;
+};
+
+// Sparse vector in arrays of feature IDs and weights, where the weights are one if nullptr
+class sparse_view {
+  public:
+    sparse_view(const uint32_t* ids, const float* weights, size_t size) : ids_(ids), weights_(weights), size_(size) {}
+
+    size_t size() const {
+        return size_;
+    }
+    ascii_format::elem_t<true> operator[](size_t k) const {
+        return {ids_[k], weights_ == nullptr ? 1.0f : weights_[k]};
+    }
+
+  private:
+    const uint32_t* ids_;
+    const float* weights_;
+    size_t size_;
+};
+
+// Computes cws_dim samples of a sparse vector of elem_t from the first_sample-th one,
+// putting the sampled feature IDs and their hash values into min_ids and min_as.
+template <class Matrix, class DataVec>
+inline void sketch_sparse(const Matrix& mat, const DataVec& data_vec, size_t cws_dim, uint32_t* min_ids,
+                          float* min_as, size_t first_sample = 0) {
+    // The log-weights are computed once per vector, not once per sample
+    thread_local vector<float> log_ws;
+    log_ws.resize(data_vec.size());
+    for (size_t k = 0; k < data_vec.size(); ++k) {
+        log_ws[k] = log10(data_vec[k].weight());
+    }
+
+    for (size_t i = 0; i < cws_dim; ++i) {
+        float min_a = numeric_limits<float>::max();
+        size_t min_id = 0;
+
+        for (size_t k = 0; k < data_vec.size(); ++k) {
+            uint32_t j = data_vec[k].id();
+            const params_t prm = mat(first_sample + i, j);
+            float t = floor(log_ws[k] / prm.r + prm.b);
+            float a = prm.log_c - (prm.r * (t + 1.0 - prm.b));
+
+            if (a < min_a) {
+                min_a = a;
+                min_id = j;
+            }
+        }
+
+        if (mat.dat_dim() <= min_id) {
+            cerr << "error: min_id exceeds dat_dim" << endl;
+            exit(1);
+        }
+        min_ids[i] = static_cast<uint32_t>(min_id);
+        min_as[i] = min_a;
+    }
+}
+
+// The feature-major version scans each feature once and streams its cells,
+// updating the running minimums of all the samples.
+template <class DataVec>
+inline void sketch_sparse(const feature_major_matrix& mat, const DataVec& data_vec, size_t cws_dim,
+                          uint32_t* min_ids, float* min_as, size_t first_sample = 0) {
+    fill(min_ids, min_ids + cws_dim, 0);
+    fill(min_as, min_as + cws_dim, numeric_limits<float>::max());
+
+    for (size_t k = 0; k < data_vec.size(); ++k) {
+        const auto feat = data_vec[k];
+        uint32_t j = feat.id();
+        if (mat.dat_dim() <= j) {
+            cerr << "error: feature ID exceeds dat_dim" << endl;
+            exit(1);
+        }
+
+        const float log_w = log10(feat.weight());
+        const feature_major_matrix::cell_t* cells = mat.feature(j) + first_sample;
+
+        for (size_t i = 0; i < cws_dim; ++i) {
+            float t = floor(log_w / cells[i].r + cells[i].b);
+            float a = cells[i].log_c - (cells[i].r * (t + 1.0 - cells[i].b));
+
+            if (a < min_as[i]) {
+                min_as[i] = a;
+                min_ids[i] = j;
+            }
+        }
+    }
+}
+
+// DartMinHash throws darts of ranks less than theta, doubling it until every sample gets a dart.
+// The minimum of each sample is final once hit, since darts not thrown yet have larger ranks.
+// The hash values are the ranks of the sampled darts.
+template <class DataVec>
+inline void sketch_sparse(const dart_minhash& mat, const DataVec& data_vec, size_t cws_dim, uint32_t* min_ids,
+                          float* min_as) {
+    fill(min_ids, min_ids + cws_dim, 0);
+    fill(min_as, min_as + cws_dim, numeric_limits<float>::max());
+
+    double total = 0.0;
+    for (size_t k = 0; k < data_vec.size(); ++k) {
+        total += max(data_vec[k].weight(), 0.0f);
+    }
+    if (total == 0.0 or cws_dim == 0) {
+        return;
+    }
+
+    thread_local vector<double> min_rs;
+    min_rs.resize(cws_dim);
+
+    // About cws_dim * (ln(cws_dim) + 2) darts hit the vector, filling all the samples with probability ~0.87
+    double theta = cws_dim * (log(double(cws_dim)) + 2.0) / total;
+
+    for (size_t unfilled = cws_dim; unfilled != 0; theta *= 2.0) {
+        fill(min_rs.begin(), min_rs.end(), numeric_limits<double>::infinity());
+
+        for (size_t k = 0; k < data_vec.size(); ++k) {
+            const auto feat = data_vec[k];
+            const double w = feat.weight();
+            if (!(w > 0.0)) {
+                continue;
+            }
+
+            // From the interval including w down to those with few darts, where the probability
+            // of no darts exp(-lo * theta) is halved in the exponent by a square root per interval
+            int e = ilogb(w);
+            double lo = ldexp(1.0, e);
+            double no_dart = exp(-lo * theta);
+            for (; lo * theta >= dart_minhash::MIN_DARTS; --e, lo *= 0.5, no_dart = sqrt(no_dart)) {
+                splitmix64 gen = mat.darts(feat.id(), e);
+                const double u = to_open_unit(gen.next());
+                if (u <= no_dart) {
+                    continue;  // The first dart has a rank of theta or more
+                }
+                for (double r = -log(u) / lo; r < theta; r -= log(to_open_unit(gen.next())) / lo) {
+                    const double v = lo * (1.0 + to_closed_unit(gen.next()));
+                    const size_t i = ((gen.next() >> 32) * cws_dim) >> 32;
+                    if (v < w and r < min_rs[i]) {
+                        min_rs[i] = r;
+                        min_ids[i] = feat.id();
+                    }
+                }
+            }
+        }
+
+        unfilled = count(min_rs.begin(), min_rs.end(), numeric_limits<double>::infinity());
+    }
+
+    for (size_t i = 0; i < cws_dim; ++i) {
+        min_as[i] = static_cast<float>(min_rs[i]);
+    }
+}
+
+// Replaces the sampled feature IDs of a sparse vector with the full samples of I2CWS
+template <class DataVec>
+inline void finalize_i2cws(const i2cws_params& prm, const DataVec& data_vec, size_t cws_dim, uint32_t* min_ids,
+                           size_t first_sample = 0) {
+    thread_local vector<ascii_format::elem_t<true>> sorted_vec;
+    sorted_vec.resize(data_vec.size());
+    for (size_t k = 0; k < data_vec.size(); ++k) {
+        sorted_vec[k] = {data_vec[k].id(), data_vec[k].weight()};
+    }
+    sort(sorted_vec.begin(), sorted_vec.end(), [](const auto& a, const auto& b) { return a.id() < b.id(); });
+
+    for (size_t i = 0; i < cws_dim; ++i) {
+        auto it = lower_bound(sorted_vec.begin(), sorted_vec.end(), min_ids[i],
+                              [](const auto& a, uint32_t id) { return a.id() < id; });
+        const float weight = (it != sorted_vec.end() and it->id() == min_ids[i]) ? it->weight() : 0.0f;
+        min_ids[i] = prm(first_sample + i, min_ids[i], weight);
+    }
+}
+
+// Computes cws_dim samples of a dense vector of dat_dim dimensions
+template <class Matrix>
+inline void sketch_dense(const Matrix& mat, const float* data_vec, size_t dat_dim, size_t cws_dim,
+                         uint32_t* min_ids, float* min_as) {
+    thread_local vector<float> log_ws;
+    log_ws.resize(dat_dim);
+    for (size_t j = 0; j < dat_dim; ++j) {
+        log_ws[j] = log10(data_vec[j]);
+    }
+
+    for (size_t i = 0; i < cws_dim; ++i) {
+        float min_a = numeric_limits<float>::max();
+        size_t min_id = 0;
+
+        for (size_t j = 0; j < dat_dim; ++j) {
+            const params_t prm = mat(i, j);
+            float t = floor(log_ws[j] / prm.r + prm.b);
+            float a = prm.log_c - (prm.r * (t + 1.0 - prm.b));
+
+            if (a < min_a) {
+                min_a = a;
+                min_id = j;
+            }
+        }
+
+        min_ids[i] = static_cast<uint32_t>(min_id);
+        min_as[i] = min_a;
+    }
+}
+
+}  // namespace cws
@@ -1,142 +1,299 @@
 #include <chrono>
 #include <numeric>
 
+#include "ascii_parser.hpp"
 #include "cmdline.h"
 #include "misc.hpp"
-#include "splitmix.hpp"
+#include "pipeline.hpp"
+#include "sketch_format.hpp"
+#include "sketcher.hpp"
 
 using namespace ascii_format;
 
 constexpr size_t BUFFER_VECS = 100'000;
 
-template <int Flags>
-int run(const cmdline::parser& p) {
+// Share of the threads parsing in parallel (with -P) while pipelined, which is far faster than sampling
+constexpr size_t PARSE_THREADS_RATIO = 4;
+
+template <class SampleType, int Flags>
+int sample_as(const cmdline::parser& p, const cws::sketcher& sketcher) {
     using data_loader_type = data_loader<Flags>;
-    using data_vec_type = vector<elem_type<Flags>>;
+    using data_vecs_type = flat_vecs<Flags>;
 
     auto input_fn = p.get<string>("input_fn");
     auto output_fn = p.get<string>("output_fn");
-    auto dat_dim = p.get<size_t>("dat_dim");
-    auto cws_dim = p.get<size_t>("cws_dim");
+    auto packed_bits = p.get<uint32_t>("packed_bits");
     auto begin_id = p.get<uint32_t>("begin_id");
-    auto seed = p.get<size_t>("seed");
+    auto pipelined = p.get<bool>("pipelined");
+    auto parallel_parse = p.get<bool>("parallel_parse");
+    auto num_tables = p.get<size_t>("num_tables");
+    auto mergeable = p.get<bool>("mergeable");
+    auto shard = parse_shard(p.get<string>("shard"));
+
+    // Each table is a band of cws_dim samples split from the sketch of total_dim samples
+    const size_t total_dim = sketcher.cws_dim();
+    const size_t cws_dim = total_dim / num_tables;
+    if (cws_dim == 0) {
+        cerr << "error: the samples are fewer than num_tables" << endl;
+        return 1;
+    }
+
+    cout << "2) Do consistent weighted sampling..." << endl;
 
+    data_loader_type in;
+    parallel_loader<Flags> parallel_in;
+    if (parallel_parse and pipelined) {
+        // The parser runs on the thread of loading concurrently with the sampling threads,
+        // so the threads are shared between them instead of oversubscribing the cores
+        const size_t num_threads = omp_get_max_threads();
+        const size_t parse_threads = max<size_t>(1, num_threads / PARSE_THREADS_RATIO);
+        const size_t sample_threads = max<size_t>(1, num_threads - parse_threads);
+        omp_set_num_threads(static_cast<int>(sample_threads));
+        cout << "threads: " << parse_threads << " for parsing, " << sample_threads << " for sampling" << endl;
+        parallel_in = parallel_loader<Flags>(input_fn, begin_id, shard, parse_threads);
+    } else if (parallel_parse) {
+        parallel_in = parallel_loader<Flags>(input_fn, begin_id, shard);
+    } else {
+        in = data_loader_type(input_fn, begin_id, shard);
+    }
+    uint32_t flags = 0;
     if (is_generalized<Flags>()) {
-        dat_dim *= 2;
+        flags |= sketch_format::GENERALIZED_FLAG;
+    }
+    if (sketcher.method() == cws::method_type::dart_minhash) {
+        flags |= sketch_format::DART_MINHASH_FLAG;
+    } else if (sketcher.type() == cws::matrix_type::matrix_free) {
+        flags |= sketch_format::MATRIX_FREE_FLAG;
+    }
+    if (sketcher.method() == cws::method_type::pcws) {
+        flags |= sketch_format::PCWS_FLAG;
+    } else if (sketcher.method() == cws::method_type::i2cws) {
+        flags |= sketch_format::I2CWS_FLAG;
+    }
+    vector<sketch_format::sketch_writer<SampleType>> outs;
+    for (size_t t = 0; t < num_tables; ++t) {
+        outs.emplace_back(num_tables == 1 ? output_fn : output_fn + "_" + to_string(t), cws_dim, packed_bits, flags,
+                          sketcher.seed(), t * cws_dim, total_dim);
+    }
+    const size_t record_bytes = outs[0].record_bytes();
+    vector<sketch_format::hash_writer> hash_outs;
+    if (mergeable) {
+        for (size_t t = 0; t < num_tables; ++t) {
+            hash_outs.emplace_back(num_tables == 1 ? output_fn : output_fn + "_" + to_string(t), cws_dim);
+        }
     }
+    // Vectors in a slice, bounding the buffer of sampled feature IDs
+    const size_t slice_vecs = max<size_t>(BUFFER_VECS / num_tables, 1);
+
+    struct batch_type {
+        data_vecs_type in_buffer;
+        vector<uint32_t> min_ids;
+        vector<float> min_as;
+        vector<uint8_t> out_buffer;  // records of each table in turn
+        vector<float> hash_buffer;   // hash values of each table in turn if mergeable
+        size_t num_vecs = 0;
+    };
+    // Triple buffering allows load, sample and write to work on different batches
+    vector<batch_type> batches(pipelined ? 3 : 1);
+
+    size_t processed = 0;
+    cws::thread_stats sample_stats;
+    auto start_tp = chrono::system_clock::now();
+
+    // Bulk Loading
+    auto load = [&](batch_type& batch) {
+        batch.in_buffer.clear();
+        if (parallel_parse) {
+            // A chunk of the file at once
+            parallel_in.next(batch.in_buffer);
+        } else {
+            while (batch.in_buffer.size() < BUFFER_VECS) {
+                if (!in.next()) {
+                    break;
+                }
+                batch.in_buffer.push_back(in.get());
+            }
+        }
+        batch.num_vecs = batch.in_buffer.size();
+        if (batch.out_buffer.size() < num_tables * batch.num_vecs * record_bytes) {
+            batch.out_buffer.resize(num_tables * batch.num_vecs * record_bytes);
+        }
+        if (mergeable and batch.hash_buffer.size() < batch.num_vecs * total_dim) {
+            batch.hash_buffer.resize(batch.num_vecs * total_dim);
+        }
+        return batch.num_vecs != 0;
+    };
+
+    // Sampling, where a chunk of parallel_parse is split into slices
+    auto sample = [&](batch_type& batch) {
+        if (batch.min_ids.size() < min(batch.num_vecs, slice_vecs) * total_dim) {
+            batch.min_ids.resize(min(batch.num_vecs, slice_vecs) * total_dim);
+            if (mergeable) {
+                batch.min_as.resize(batch.min_ids.size());
+            }
+        }
 
-    cout << "1) Generate random matrix data..." << endl;
+        for (size_t beg = 0; beg < batch.num_vecs; beg += slice_vecs) {
+            const size_t num_vecs = min(slice_vecs, batch.num_vecs - beg);
+            const data_vecs_type& vecs = batch.in_buffer;
+            sketcher.sketch_sparse(num_vecs, vecs.offsets() + beg, vecs.ids(), vecs.weights(), batch.min_ids.data(),
+                                   mergeable ? batch.min_as.data() : nullptr, &sample_stats);
 
-    vector<float> R(dat_dim * cws_dim);
-    vector<float> C(dat_dim * cws_dim);
-    vector<float> B(dat_dim * cws_dim);
+#pragma omp parallel for
+            for (size_t k = 0; k < num_vecs; ++k) {
+                for (size_t t = 0; t < num_tables; ++t) {
+                    outs[t].encode(&batch.min_ids[k * total_dim + t * cws_dim],
+                                   &batch.out_buffer[(t * batch.num_vecs + beg + k) * record_bytes]);
+                    if (mergeable) {
+                        const float* min_as = &batch.min_as[k * total_dim + t * cws_dim];
+                        std::copy(min_as, min_as + cws_dim,
+                                  &batch.hash_buffer[(t * batch.num_vecs + beg + k) * cws_dim]);
+                    }
+                }
+            }
+        }
+    };
+
+    // Write
+    auto write = [&](batch_type& batch) {
+        for (size_t t = 0; t < num_tables; ++t) {
+            outs[t].write(&batch.out_buffer[t * batch.num_vecs * record_bytes], batch.num_vecs);
+            if (mergeable) {
+                hash_outs[t].write(&batch.hash_buffer[t * batch.num_vecs * cws_dim], batch.num_vecs);
+            }
+        }
 
-    splitmix64 seeder(seed);
-    const size_t seed_R = seeder.next();
-    const size_t seed_C = seeder.next();
-    const size_t seed_B = seeder.next();
+        processed += batch.num_vecs;
+        auto dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
 
-    auto start_tp = chrono::system_clock::now();
+        cout << processed << " vecs processed in ";
+        cout << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s" << endl;
+    };
 
-#pragma omp parallel sections
-    {
-#pragma omp section
-        generate_random_matrix(gamma_t(2.0, 1.0), R, seed_R);
-#pragma omp section
-        generate_random_matrix(gamma_t(2.0, 1.0), C, seed_C);
-#pragma omp section
-        generate_random_matrix(uniform_t(0.0, 1.0), B, seed_B);
-    }
+    pipeline_stats stats = run_pipeline(batches, load, sample, write);
 
     auto dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
-    cout << "Elapsed time: " << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s" << endl;
-
-    {
-        // Consume (4 * num_samples * data_dim) bytes for each matrix
-        auto MiB = (sizeof(float) * R.size() * 3) / (1024.0 * 1024.0);
-        cout << "The random matrix data consumes " << MiB << " MiB" << endl;
+    cout << "Completed!! --> " << processed << " vecs processed in ";
+    cout << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s!!" << endl;
+    stats.print(cout);
+    sample_stats.print(cout);
+    if (parallel_parse) {
+        cout << "Parsed " << parallel_in.parsed_MiB() << " MiB at " << parallel_in.parse_MiB_per_sec() << " MiB/s"
+             << endl;
     }
 
-    cout << "2) Do consistent weighted sampling..." << endl;
+    for (auto& out : outs) {
+        out.finish();
+        cout << "Output " << out.filename() << endl;
+    }
+    for (auto& out : hash_outs) {
+        out.finish();
+        cout << "Output " << out.filename() << endl;
+    }
+    return 0;
+}
 
-    data_loader_type in(input_fn, begin_id);
-    ofstream out = make_ofstream(output_fn + ".bvecs");
+template <int Flags>
+int run(const cmdline::parser& p) {
+    auto dat_dim = p.get<size_t>("dat_dim");
+    auto cws_dim = p.get<size_t>("cws_dim");
+    auto seed = p.get<size_t>("seed");
+    auto matrix_free = p.get<bool>("matrix_free");
+    auto feature_major = p.get<bool>("feature_major");
+    auto model_fn = p.get<string>("model_fn");
+    auto sample_bits = p.get<uint32_t>("sample_bits");
+    auto method = cws::parse_method(p.get<string>("method"));
+    auto num_tables = p.get<size_t>("num_tables");
+    auto mergeable = p.get<bool>("mergeable");
 
-    vector<data_vec_type> in_buffer(BUFFER_VECS);
-    vector<uint8_t> out_buffer(BUFFER_VECS * cws_dim);
+    if (is_generalized<Flags>()) {
+        dat_dim *= 2;
+    }
+    if (num_tables == 0) {
+        cerr << "error: num_tables must be positive" << endl;
+        return 1;
+    }
+    if (is_stdio(p.get<string>("output_fn")) and (num_tables != 1 or mergeable)) {
+        cerr << "error: the standard output can carry only one table without hash values" << endl;
+        return 1;
+    }
+    // Merging needs the full feature IDs
+    if (mergeable and (sample_bits != 32 or p.get<uint32_t>("packed_bits") != 0)) {
+        cerr << "error: mergeable needs sample_bits of 32 without packed_bits" << endl;
+        return 1;
+    }
+    // DartMinHash draws darts up to a threshold depending on the weights of all the features,
+    // so the samples of parts are not those of the whole vectors
+    if (mergeable and method == cws::method_type::dart_minhash) {
+        cerr << "error: mergeable cannot be used with dart" << endl;
+        return 1;
+    }
+    // The tables are split from one sketch
+    const size_t total_dim = cws_dim * num_tables;
 
-    size_t processed = 0;
-    start_tp = chrono::system_clock::now();
+    cws::sketcher sketcher;
+    auto start_tp = chrono::system_clock::now();
 
-    while (true) {
-        // Bulk Loading
-        size_t num_vecs = 0;
-        while (num_vecs < BUFFER_VECS) {
-            if (!in.next()) {
-                break;
-            }
-            in_buffer[num_vecs] = in.get();
-            num_vecs += 1;
+    if (method == cws::method_type::dart_minhash) {
+        if (!model_fn.empty()) {
+            cerr << "error: dart cannot be used with model_fn" << endl;
+            return 1;
         }
-
-        if (num_vecs == 0) {
-            break;
+        cout << "1) Derive darts on the fly from the seed" << endl;
+        sketcher = cws::sketcher(0, total_dim, seed, cws::matrix_type::matrix_free, method);
+    } else if (!model_fn.empty()) {
+        if (matrix_free) {
+            cerr << "error: matrix_free cannot be used with model_fn" << endl;
+            return 1;
         }
 
-        // Sampling
-#pragma omp parallel for
-        for (size_t id = 0; id < num_vecs; ++id) {
-            const data_vec_type& data_vec = in_buffer[id];
-            uint8_t* cws_vec = &out_buffer[id * cws_dim];
-
-            for (size_t i = 0; i < cws_dim; ++i) {
-                const float* vec_R = &R[i * dat_dim];
-                const float* vec_C = &C[i * dat_dim];
-                const float* vec_B = &B[i * dat_dim];
-
-                float min_a = numeric_limits<float>::max();
-                size_t min_id = 0;
-
-                for (const auto& feat : data_vec) {
-                    uint32_t j = feat.id();
-                    float t = floor(log10(feat.weight()) / vec_R[j] + vec_B[j]);
-                    float a = log10(vec_C[j]) - (vec_R[j] * (t + 1.0 - vec_B[j]));
-
-                    if (a < min_a) {
-                        min_a = a;
-                        min_id = j;
-                    }
-                }
+        cout << "1) Map random matrix data from " << model_fn << endl;
+        // If cws_dim is not given, all the samples of the model are used
+        sketcher = cws::sketcher(model_fn, p.exist("cws_dim") ? total_dim : 0);
 
-                if (dat_dim <= min_id) {
-                    cerr << "error: min_id exceeds dat_dim" << endl;
-                    exit(1);
-                }
+        auto dur_cnt = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now() - start_tp).count();
+        cout << "Elapsed time: " << dur_cnt << "ms" << endl;
 
-                // Write the lowest 8 bits for samples
-                cws_vec[i] = static_cast<uint8_t>(min_id & UINT8_MAX);
-            }
+        if (p.exist("dat_dim") and sketcher.dat_dim() != dat_dim) {
+            cerr << "error: dat_dim differs from that of the model (" << sketcher.dat_dim() << ")" << endl;
+            return 1;
         }
-
-        // Write
-        for (size_t id = 0; id < num_vecs; ++id) {
-            write_value(out, static_cast<uint32_t>(cws_dim));
-            write_vec(out, &out_buffer[id * cws_dim], cws_dim);
+        if (p.exist("seed") and sketcher.seed() != seed) {
+            cerr << "error: seed differs from that of the model (" << sketcher.seed() << ")" << endl;
+            return 1;
+        }
+        if (p.exist("method") and sketcher.method() != method) {
+            cerr << "error: method differs from that of the model (" << cws::get_method_name(sketcher.method())
+                 << ")" << endl;
+            return 1;
+        }
+    } else if (matrix_free) {
+        cout << "1) Derive random matrix data on the fly from the seed" << endl;
+        sketcher = cws::sketcher(0, total_dim, seed, cws::matrix_type::matrix_free, method);
+    } else {
+        if (dat_dim == 0) {
+            cerr << "error: dat_dim must be set unless matrix_free" << endl;
+            return 1;
         }
 
-        processed += num_vecs;
-        dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
+        cout << "1) Generate random matrix data..." << endl;
+        sketcher = cws::sketcher(dat_dim, total_dim, seed,
+                                 feature_major ? cws::matrix_type::feature_major : cws::matrix_type::sample_major,
+                                 method);
 
-        cout << processed << " vecs processed in ";
-        cout << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s" << endl;
+        auto dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
+        cout << "Elapsed time: " << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s" << endl;
     }
 
-    dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
-    cout << "Completed!! --> " << processed << " vecs processed in ";
-    cout << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s!!" << endl;
+    if (sketcher.type() != cws::matrix_type::matrix_free) {
+        // Consume (4 * 3 * num_samples * data_dim) bytes
+        auto MiB = sketcher.memory_in_bytes() / (1024.0 * 1024.0);
+        cout << "The random matrix data consumes " << MiB << " MiB" << endl;
+    }
 
-    cout << "Output " << output_fn << ".bvecs" << endl;
-    return 0;
+    return sketch_format::dispatch_sample_type(sample_bits, [&](auto sample_type) {
+        return sample_as<decltype(sample_type), Flags>(p, sketcher);
+    });
 }
 
 template <int Flags = 0>
@@ -154,24 +311,48 @@ int run_with_flags(int flags, const cmdline::parser& p) {
 
 int main(int argc, char** argv) {
     ios::sync_with_stdio(false);
-    cout << "num threads: " << omp_get_max_threads() << endl;
 
     cmdline::parser p;
-    p.add<string>("input_fn", 'i', "input file name of database vectors (in ASCII format)", true);
-    p.add<string>("output_fn", 'o', "output file name of CWS-sketches (in bvecs format)", true);
-    p.add<size_t>("dat_dim", 'd', "dimension of the input data", true);
+    p.add<string>("input_fn", 'i',
+                  "input file name of database vectors (in ASCII format, optionally .gz/.bz2/.zst), or - for stdin",
+                  true);
+    p.add<string>("output_fn", 'o',
+                  "output file name of CWS-sketches (in bvecs/svecs/ivecs or cws format), or - for stdout", true);
+    p.add<size_t>("dat_dim", 'd', "dimension of the input data (not needed if matrix_free)", false, 0);
     p.add<size_t>("cws_dim", 'D', "dimension of the output CWS-sketches", false, 64);
     p.add<uint32_t>("begin_id", 'b', "beginning ID of data column", false, 0);
     p.add<bool>("weighted", 'w', "Does the input data have weight?", false, false);
     p.add<bool>("generalized", 'g', "Does the input data need to be generalized?", false, false);
     p.add<bool>("labeled", 'l', "Does each input vector have a label at the head?", false, false);
     p.add<size_t>("seed", 's', "seed for random matrix data", false, 114514);
+    p.add<string>("method", 'a', "sampling method (icws/pcws/i2cws/dart)", false, "icws");
+    p.add<bool>("matrix_free", 'm', "Derive random matrix data on the fly instead of storing it?", false, false);
+    p.add<bool>("feature_major", 'F', "Store random matrix data in feature-major order? (faster for sparse data)",
+                false, false);
+    p.add<string>("model_fn", 'M', "input file name of the model of random matrix data made by make_cws_model",
+                  false, "");
+    p.add<bool>("parallel_parse", 'P', "Parse the input file in parallel via mmap?", false, false);
+    p.add<uint32_t>("sample_bits", 'W', "bits per sample in bvecs/svecs/ivecs format (8/16/32)", false, 8);
+    p.add<uint32_t>("packed_bits", 'B', "bits per sample packed in cws format (1-32), or 0 for bvecs/svecs/ivecs format",
+                    false, 0);
+    p.add<size_t>("num_tables", 'L', "number of tables of cws_dim samples, output to files suffixed with _0, _1, ...",
+                  false, 1);
+    p.add<bool>("mergeable", 'e', "Also output the hash values of samples in fvecs format to merge with merge_cws?",
+                false, false);
+    p.add<string>("shard", 'S', "portion i/n of the input file to process, splitting it among n processes", false,
+                  "0/1");
+    p.add<bool>("pipelined", 'p', "Overlap loading and writing with sampling on their own threads?", false, false);
     p.parse_check(argc, argv);
 
+    if (is_stdio(p.get<string>("output_fn"))) {
+        redirect_logs();
+    }
+    cout << "num threads: " << omp_get_max_threads() << endl;
+
     auto weighted = p.get<bool>("weighted");
     auto generalized = p.get<bool>("generalized");
     auto labeled = p.get<bool>("labeled");
 
     auto flags = make_flags(weighted, generalized, labeled);
     return run_with_flags(flags, p);
-}
\ No newline at end of file
+}
@@ -3,153 +3,236 @@
 
 #include "cmdline.h"
 #include "misc.hpp"
-#include "splitmix.hpp"
+#include "pipeline.hpp"
+#include "sketch_format.hpp"
+#include "sketcher.hpp"
 
 using namespace texmex_format;
 
 constexpr size_t BUFFER_VECS = 100'000;
 
-template <typename InType, bool Generalized>
-int run(const cmdline::parser& p) {
+template <class SampleType, typename InType, bool Generalized>
+int sample_as(const cmdline::parser& p, const cws::sketcher& sketcher, size_t dat_dim) {
     auto input_fn = p.get<string>("input_fn");
     auto output_fn = p.get<string>("output_fn");
-    auto dat_dim = p.get<size_t>("dat_dim");
-    auto cws_dim = p.get<size_t>("cws_dim");
-    auto seed = p.get<size_t>("seed");
-
-    if constexpr (Generalized) {
-        dat_dim *= 2;
-    }
-
-    cout << "1) Generate random matrix data..." << endl;
+    auto packed_bits = p.get<uint32_t>("packed_bits");
+    auto pipelined = p.get<bool>("pipelined");
+    auto shard = parse_shard(p.get<string>("shard"));
 
-    vector<float> R(dat_dim * cws_dim);
-    vector<float> C(dat_dim * cws_dim);
-    vector<float> B(dat_dim * cws_dim);
+    const size_t cws_dim = sketcher.cws_dim();
 
-    splitmix64 seeder(seed);
-    const size_t seed_R = seeder.next();
-    const size_t seed_C = seeder.next();
-    const size_t seed_B = seeder.next();
-
-    auto start_tp = chrono::system_clock::now();
+    cout << "2) Do consistent weighted sampling..." << endl;
 
-#pragma omp parallel sections
-    {
-#pragma omp section
-        generate_random_matrix(gamma_t(2.0, 1.0), R, seed_R);
-#pragma omp section
-        generate_random_matrix(gamma_t(2.0, 1.0), C, seed_C);
-#pragma omp section
-        generate_random_matrix(uniform_t(0.0, 1.0), B, seed_B);
+    if (sketcher.type() == cws::matrix_type::sample_major) {
+        cout << "SIMD instruction set: " << get_simd_name(sketcher.get_simd_level()) << endl;
     }
 
-    auto dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
-    cout << "Elapsed time: " << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s" << endl;
-
-    {
-        // Consume (4 * num_samples * data_dim) bytes for each matrix
-        auto MiB = (sizeof(float) * R.size() * 3) / (1024.0 * 1024.0);
-        cout << "The random matrix data consumes " << MiB << " MiB" << endl;
+    data_loader<InType, float, Generalized> in(input_fn, dat_dim, shard);
+    uint32_t flags = 0;
+    if (Generalized) {
+        flags |= sketch_format::GENERALIZED_FLAG;
     }
+    if (sketcher.method() == cws::method_type::dart_minhash) {
+        flags |= sketch_format::DART_MINHASH_FLAG;
+    } else if (sketcher.type() == cws::matrix_type::matrix_free) {
+        flags |= sketch_format::MATRIX_FREE_FLAG;
+    }
+    if (sketcher.method() == cws::method_type::pcws) {
+        flags |= sketch_format::PCWS_FLAG;
+    } else if (sketcher.method() == cws::method_type::i2cws) {
+        flags |= sketch_format::I2CWS_FLAG;
+    }
+    sketch_format::sketch_writer<SampleType> out(output_fn, cws_dim, packed_bits, flags, sketcher.seed());
+    const size_t record_bytes = out.record_bytes();
 
-    cout << "2) Do consistent weighted sampling..." << endl;
-
-    data_loader<InType, float, Generalized> in(input_fn, dat_dim);
-    ofstream out = make_ofstream(output_fn + ".bvecs");
-
-    vector<float> in_buffer(BUFFER_VECS * dat_dim);
-    vector<uint8_t> out_buffer(BUFFER_VECS * cws_dim);
+    struct batch_type {
+        vector<float> in_buffer;
+        vector<uint32_t> min_ids;
+        vector<uint8_t> out_buffer;
+        size_t num_vecs = 0;
+    };
+    // Triple buffering allows load, sample and write to work on different batches
+    vector<batch_type> batches(pipelined ? 3 : 1);
+    for (batch_type& batch : batches) {
+        batch.in_buffer.resize(BUFFER_VECS * dat_dim);
+        batch.out_buffer.resize(BUFFER_VECS * record_bytes);
+    }
 
     size_t processed = 0;
-    start_tp = chrono::system_clock::now();
+    size_t sparsified = 0;
+    auto start_tp = chrono::system_clock::now();
 
-    while (true) {
-        // Bulk Loading
-        size_t num_vecs = 0;
-        while (num_vecs < BUFFER_VECS) {
+    // Bulk Loading
+    auto load = [&](batch_type& batch) {
+        batch.num_vecs = 0;
+        while (batch.num_vecs < BUFFER_VECS) {
             const float* data_vec = in.next();
             if (data_vec == nullptr) {
                 break;
             }
-            std::copy(data_vec, data_vec + dat_dim, &in_buffer[num_vecs * dat_dim]);
-            num_vecs += 1;
+            std::copy(data_vec, data_vec + dat_dim, &batch.in_buffer[batch.num_vecs * dat_dim]);
+            batch.num_vecs += 1;
         }
+        return batch.num_vecs != 0;
+    };
 
-        if (num_vecs == 0) {
-            break;
+    // Sampling
+    auto sample = [&](batch_type& batch) {
+        if (batch.min_ids.size() < batch.num_vecs * cws_dim) {
+            batch.min_ids.resize(batch.num_vecs * cws_dim);
         }
+        sparsified += sketcher.sketch_dense(batch.num_vecs, dat_dim, batch.in_buffer.data(), batch.min_ids.data());
 
-        // Sampling
 #pragma omp parallel for
-        for (size_t id = 0; id < num_vecs; ++id) {
-            const float* data_vec = &in_buffer[id * dat_dim];
-            uint8_t* cws_vec = &out_buffer[id * cws_dim];
-
-            for (size_t i = 0; i < cws_dim; ++i) {
-                const float* vec_R = &R[i * dat_dim];
-                const float* vec_C = &C[i * dat_dim];
-                const float* vec_B = &B[i * dat_dim];
-
-                float min_a = numeric_limits<float>::max();
-                size_t min_id = 0;
-
-                for (size_t j = 0; j < dat_dim; ++j) {
-                    float t = floor(log10(data_vec[j]) / vec_R[j] + vec_B[j]);
-                    float a = log10(vec_C[j]) - (vec_R[j] * (t + 1.0 - vec_B[j]));
-
-                    if (a < min_a) {
-                        min_a = a;
-                        min_id = j;
-                    }
-                }
-
-                // Write the lowest 8 bits for samples
-                cws_vec[i] = static_cast<uint8_t>(min_id & UINT8_MAX);
-            }
+        for (size_t id = 0; id < batch.num_vecs; ++id) {
+            out.encode(&batch.min_ids[id * cws_dim], &batch.out_buffer[id * record_bytes]);
         }
+    };
 
-        // Write
-        for (size_t id = 0; id < num_vecs; ++id) {
-            write_value(out, static_cast<uint32_t>(cws_dim));
-            write_vec(out, &out_buffer[id * cws_dim], cws_dim);
-        }
+    // Write
+    auto write = [&](batch_type& batch) {
+        out.write(batch.out_buffer.data(), batch.num_vecs);
 
-        processed += num_vecs;
-        dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
+        processed += batch.num_vecs;
+        auto dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
 
         cout << processed << " vecs processed in ";
         cout << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s" << endl;
-    }
+    };
 
-    dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
+    pipeline_stats stats = run_pipeline(batches, load, sample, write);
+
+    auto dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
     cout << "Completed!! --> " << processed << " vecs processed in ";
     cout << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s!!" << endl;
+    cout << sparsified << " vecs were sampled as sparse vectors" << endl;
+    stats.print(cout);
 
-    cout << "Output " << output_fn << ".bvecs" << endl;
+    out.finish();
+    cout << "Output " << out.filename() << endl;
     return 0;
 }
 
+template <typename InType, bool Generalized>
+int run(const cmdline::parser& p) {
+    auto dat_dim = p.get<size_t>("dat_dim");
+    auto cws_dim = p.get<size_t>("cws_dim");
+    auto seed = p.get<size_t>("seed");
+    auto matrix_free = p.get<bool>("matrix_free");
+    auto model_fn = p.get<string>("model_fn");
+    auto sample_bits = p.get<uint32_t>("sample_bits");
+    auto method = cws::parse_method(p.get<string>("method"));
+
+    if constexpr (Generalized) {
+        dat_dim *= 2;
+    }
+
+    cws::sketcher sketcher;
+    auto start_tp = chrono::system_clock::now();
+
+    if (method == cws::method_type::dart_minhash) {
+        if (!model_fn.empty()) {
+            cerr << "error: dart cannot be used with model_fn" << endl;
+            return 1;
+        }
+        cout << "1) Derive darts on the fly from the seed" << endl;
+        sketcher = cws::sketcher(dat_dim, cws_dim, seed, cws::matrix_type::matrix_free, method);
+    } else if (!model_fn.empty()) {
+        if (matrix_free) {
+            cerr << "error: matrix_free cannot be used with model_fn" << endl;
+            return 1;
+        }
+
+        cout << "1) Map random matrix data from " << model_fn << endl;
+        // If cws_dim is not given, all the samples of the model are used
+        sketcher = cws::sketcher(model_fn, p.exist("cws_dim") ? cws_dim : 0);
+
+        auto dur_cnt = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now() - start_tp).count();
+        cout << "Elapsed time: " << dur_cnt << "ms" << endl;
+
+        if (sketcher.dat_dim() != dat_dim) {
+            cerr << "error: dat_dim differs from that of the model (" << sketcher.dat_dim() << ")" << endl;
+            return 1;
+        }
+        if (p.exist("seed") and sketcher.seed() != seed) {
+            cerr << "error: seed differs from that of the model (" << sketcher.seed() << ")" << endl;
+            return 1;
+        }
+        if (p.exist("method") and sketcher.method() != method) {
+            cerr << "error: method differs from that of the model (" << cws::get_method_name(sketcher.method())
+                 << ")" << endl;
+            return 1;
+        }
+    } else if (matrix_free) {
+        cout << "1) Derive random matrix data on the fly from the seed" << endl;
+        sketcher = cws::sketcher(dat_dim, cws_dim, seed, cws::matrix_type::matrix_free, method);
+    } else {
+        cout << "1) Generate random matrix data..." << endl;
+        sketcher = cws::sketcher(dat_dim, cws_dim, seed, cws::matrix_type::sample_major, method);
+
+        auto dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
+        cout << "Elapsed time: " << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s" << endl;
+    }
+
+    if (sketcher.type() != cws::matrix_type::matrix_free) {
+        // Consume (4 * 3 * num_samples * data_dim) bytes
+        auto MiB = sketcher.memory_in_bytes() / (1024.0 * 1024.0);
+        cout << "The random matrix data consumes " << MiB << " MiB" << endl;
+    }
+
+    sketcher.set_simd_level(parse_simd_level(p.get<string>("simd")));
+    sketcher.set_sparse_density(p.get<float>("sparse_density"));
+
+    return sketch_format::dispatch_sample_type(sample_bits, [&](auto sample_type) {
+        return sample_as<decltype(sample_type), InType, Generalized>(p, sketcher, dat_dim);
+    });
+}
+
 int main(int argc, char** argv) {
     ios::sync_with_stdio(false);
-    cout << "num threads: " << omp_get_max_threads() << endl;
 
     cmdline::parser p;
-    p.add<string>("input_fn", 'i', "input file name of database vectors (in fvecs/bvecs format)", true);
-    p.add<string>("output_fn", 'o', "output file name of CWS-sketches (in bvecs format)", true);
+    p.add<string>("input_fn", 'i',
+                  "input file name of database vectors (in fvecs/bvecs format, optionally .gz/.bz2/.zst), "
+                  "or - for stdin",
+                  true);
+    p.add<string>("output_fn", 'o',
+                  "output file name of CWS-sketches (in bvecs/svecs/ivecs or cws format), or - for stdout", true);
     p.add<string>("format", 'f', "format of the input file (fvecs/bvecs); if empty, use the extension", false, "");
     p.add<size_t>("dat_dim", 'd', "dimension of the input data", true);
     p.add<size_t>("cws_dim", 'D', "dimension of the output CWS-sketches", false, 64);
     p.add<bool>("generalized", 'g', "Does the input data need to be generalized?", false, false);
     p.add<size_t>("seed", 's', "seed for random matrix data", false, 114514);
+    p.add<string>("method", 'a', "sampling method (icws/pcws/i2cws/dart)", false, "icws");
+    p.add<bool>("matrix_free", 'm', "Derive random matrix data on the fly instead of storing it?", false, false);
+    p.add<string>("model_fn", 'M', "input file name of the model of random matrix data made by make_cws_model",
+                  false, "");
+    p.add<float>("sparse_density", 'z', "density of nonzero features below which vectors are sampled as sparse ones",
+                 false, 0.15);
+    p.add<uint32_t>("sample_bits", 'W', "bits per sample in bvecs/svecs/ivecs format (8/16/32)", false, 8);
+    p.add<uint32_t>("packed_bits", 'B', "bits per sample packed in cws format (1-32), or 0 for bvecs/svecs/ivecs format",
+                    false, 0);
+    p.add<string>("shard", 'S', "portion i/n of the input file to process, splitting it among n processes", false,
+                  "0/1");
+    p.add<bool>("pipelined", 'p', "Overlap loading and writing with sampling on their own threads?", false, false);
+    p.add<string>("simd", 'x', "SIMD instruction set for sampling (auto/scalar/sse4/avx2/avx512)", false, "auto");
     p.parse_check(argc, argv);
 
+    if (is_stdio(p.get<string>("output_fn"))) {
+        redirect_logs();
+    }
+    cout << "num threads: " << omp_get_max_threads() << endl;
+
     auto input_fn = p.get<string>("input_fn");
     auto format = p.get<string>("format");
     auto generalized = p.get<bool>("generalized");
 
     if (format.empty()) {
-        format = get_ext(input_fn);
+        if (is_stdio(input_fn)) {
+            cerr << "error: format must be given for the standard input" << endl;
+            return 1;
+        }
+        format = get_ext(strip_compression_ext(input_fn));
     }
 
     if (format == "fvecs") {
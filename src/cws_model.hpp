@@ -0,0 +1,105 @@
+#pragma once
+
+#include "cws.hpp"
+
+/****
+ *  Model file of random matrix data (.model)
+ *
+ *  The file consists of a 64-byte header followed by the parameters of random_matrix
+ *  (R, log10(C) and B in sample-major order) or of feature_major_matrix (cells in feature-major order).
+ *  The header also records the sampling method (cws::method_type) the parameters are drawn for.
+ *  The parameters are memory-mapped read-only, so later runs skip the generation and
+ *  concurrent processes share the page cache.
+ */
+namespace cws_model {
+
+constexpr char MAGIC[8] = {'C', 'W', 'S', 'M', 'O', 'D', 'E', 'L'};
+// Version 2 since random matrix data is generated in blocks
+constexpr uint32_t VERSION = 2;
+
+constexpr uint32_t SAMPLE_MAJOR_LAYOUT = 0;
+constexpr uint32_t FEATURE_MAJOR_LAYOUT = 1;
+
+struct header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;
+    uint64_t dat_dim;
+    uint64_t cws_dim;
+    uint64_t seed;
+    uint32_t method;  // zero (icws) in files made before the field
+    uint8_t reserved[20];
+};
+static_assert(sizeof(header_t) == 64);
+static_assert(sizeof(cws::feature_major_matrix::cell_t) == sizeof(float) * 3);
+
+template <class Matrix>
+constexpr uint32_t get_layout() {
+    if constexpr (is_same_v<Matrix, cws::feature_major_matrix>) {
+        return FEATURE_MAJOR_LAYOUT;
+    } else {
+        static_assert(is_same_v<Matrix, cws::random_matrix>);
+        return SAMPLE_MAJOR_LAYOUT;
+    }
+}
+
+inline const char* get_layout_name(uint32_t layout) {
+    return layout == FEATURE_MAJOR_LAYOUT ? "feature-major" : "sample-major";
+}
+
+template <class Matrix>
+inline void save(const string& fn, const Matrix& mat, uint32_t method) {
+    header_t header = {};
+    copy(MAGIC, MAGIC + 8, header.magic);
+    header.version = VERSION;
+    header.layout = get_layout<Matrix>();
+    header.dat_dim = mat.dat_dim();
+    header.cws_dim = mat.cws_dim();
+    header.seed = mat.seed();
+    header.method = method;
+
+    ofstream ofs = make_ofstream(fn);
+    write_value(ofs, header);
+    if constexpr (is_same_v<Matrix, cws::feature_major_matrix>) {
+        write_vec(ofs, mat.feature(0), mat.dat_dim() * mat.cws_dim());
+    } else {
+        const size_t size = mat.dat_dim() * mat.cws_dim();
+        write_vec(ofs, mat.r_row(0), size);
+        write_vec(ofs, mat.log_c_row(0), size);
+        write_vec(ofs, mat.b_row(0), size);
+    }
+    if (!ofs) {
+        cerr << "write error: " << fn << endl;
+        exit(1);
+    }
+}
+
+inline header_t load_header(const string& fn) {
+    ifstream ifs = make_ifstream(fn);
+    auto header = read_value<header_t>(ifs);
+    if (!ifs or !equal(MAGIC, MAGIC + 8, header.magic) or header.version != VERSION) {
+        cerr << "error: invalid model file: " << fn << endl;
+        exit(1);
+    }
+    return header;
+}
+
+// Maps the model file of Matrix without reading the parameters
+template <class Matrix>
+inline Matrix load(const string& fn) {
+    const header_t header = load_header(fn);
+    if (header.layout != get_layout<Matrix>()) {
+        cerr << "error: the model file is in " << get_layout_name(header.layout) << " layout: " << fn << endl;
+        exit(1);
+    }
+
+    // Both the layouts store three floats per cell
+    mmap_file file(fn);
+    if (file.size() != sizeof(header_t) + sizeof(float) * 3 * header.dat_dim * header.cws_dim) {
+        cerr << "error: invalid model file: " << fn << endl;
+        exit(1);
+    }
+    return Matrix(header.dat_dim, header.cws_dim, header.seed, move(file), sizeof(header_t));
+}
+
+}  // namespace cws_model
@@ -0,0 +1,218 @@
+#pragma once
+
+#include "cws.hpp"
+#include "simd.hpp"
+
+/****
+ *  SIMD kernels of consistent weighted sampling for dense vectors.
+ *
+ *  The hash values are computed with the same sequence of float and double operations
+ *  as the scalar kernel and ties are broken by the smallest feature ID,
+ *  so that the kernels produce the same samples as sketch_dense.
+ *  This needs the operations not to be contracted into FMA (-ffp-contract=off, as set by CMakeLists.txt),
+ *  which would round the scalar and SIMD expressions differently depending on the compiler.
+ */
+namespace cws {
+
+// Continues the scalar argmin over the features in [begin, end)
+inline void argmin_scalar(const float* log_ws, const float* R, const float* logC, const float* B, size_t begin,
+                          size_t end, float& min_a, uint32_t& min_id) {
+    for (size_t j = begin; j < end; ++j) {
+        float t = floor(log_ws[j] / R[j] + B[j]);
+        float a = logC[j] - (R[j] * (t + 1.0 - B[j]));
+
+        if (a < min_a) {
+            min_a = a;
+            min_id = static_cast<uint32_t>(j);
+        }
+    }
+}
+
+// Reduces the per-lane minimums, where each lane keeps the first minimum of its features
+inline void argmin_lanes(const float* mins, const uint32_t* ids, size_t lanes, float& min_a, uint32_t& min_id) {
+    for (size_t l = 0; l < lanes; ++l) {
+        if (mins[l] < min_a or (mins[l] == min_a and ids[l] < min_id)) {
+            min_a = mins[l];
+            min_id = ids[l];
+        }
+    }
+}
+
+#ifdef CWS_X86
+
+__attribute__((target("sse4.1"))) inline __m128d calc_a_sse4(__m128d t, __m128d r, __m128d b, __m128d log_c) {
+    const __m128d u = _mm_sub_pd(_mm_add_pd(t, _mm_set1_pd(1.0)), b);
+    return _mm_sub_pd(log_c, _mm_mul_pd(r, u));
+}
+
+__attribute__((target("sse4.1"))) inline void argmin_sse4(const float* log_ws, const float* R, const float* logC,
+                                                           const float* B, size_t dat_dim, float& min_a,
+                                                           uint32_t& min_id) {
+    const size_t n = dat_dim / 4 * 4;
+
+    __m128 vmin = _mm_set1_ps(numeric_limits<float>::max());
+    __m128i vmin_id = _mm_setzero_si128();
+    __m128i vid = _mm_setr_epi32(0, 1, 2, 3);
+
+    for (size_t j = 0; j < n; j += 4) {
+        const __m128 r = _mm_loadu_ps(R + j);
+        const __m128 b = _mm_loadu_ps(B + j);
+        const __m128 log_c = _mm_loadu_ps(logC + j);
+        const __m128 t = _mm_floor_ps(_mm_add_ps(_mm_div_ps(_mm_loadu_ps(log_ws + j), r), b));
+
+        // Lanes 0-1 and 2-3 in double precision
+        const __m128d a_lo = calc_a_sse4(_mm_cvtps_pd(t), _mm_cvtps_pd(r), _mm_cvtps_pd(b), _mm_cvtps_pd(log_c));
+        const __m128d a_hi = calc_a_sse4(_mm_cvtps_pd(_mm_movehl_ps(t, t)), _mm_cvtps_pd(_mm_movehl_ps(r, r)),
+                                         _mm_cvtps_pd(_mm_movehl_ps(b, b)), _mm_cvtps_pd(_mm_movehl_ps(log_c, log_c)));
+        const __m128 a = _mm_movelh_ps(_mm_cvtpd_ps(a_lo), _mm_cvtpd_ps(a_hi));
+
+        const __m128 lt = _mm_cmplt_ps(a, vmin);
+        vmin = _mm_blendv_ps(vmin, a, lt);
+        vmin_id = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(vmin_id), _mm_castsi128_ps(vid), lt));
+        vid = _mm_add_epi32(vid, _mm_set1_epi32(4));
+    }
+
+    alignas(16) float mins[4];
+    alignas(16) uint32_t ids[4];
+    _mm_store_ps(mins, vmin);
+    _mm_store_si128(reinterpret_cast<__m128i*>(ids), vmin_id);
+    argmin_lanes(mins, ids, 4, min_a, min_id);
+    argmin_scalar(log_ws, R, logC, B, n, dat_dim, min_a, min_id);
+}
+
+__attribute__((target("avx2"))) inline __m128 calc_a_avx2(__m128 t, __m128 r, __m128 b, __m128 log_c) {
+    const __m256d u = _mm256_sub_pd(_mm256_add_pd(_mm256_cvtps_pd(t), _mm256_set1_pd(1.0)), _mm256_cvtps_pd(b));
+    return _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_cvtps_pd(log_c), _mm256_mul_pd(_mm256_cvtps_pd(r), u)));
+}
+
+__attribute__((target("avx2"))) inline void argmin_avx2(const float* log_ws, const float* R, const float* logC,
+                                                         const float* B, size_t dat_dim, float& min_a,
+                                                         uint32_t& min_id) {
+    const size_t n = dat_dim / 8 * 8;
+
+    __m256 vmin = _mm256_set1_ps(numeric_limits<float>::max());
+    __m256i vmin_id = _mm256_setzero_si256();
+    __m256i vid = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (size_t j = 0; j < n; j += 8) {
+        const __m256 r = _mm256_loadu_ps(R + j);
+        const __m256 b = _mm256_loadu_ps(B + j);
+        const __m256 log_c = _mm256_loadu_ps(logC + j);
+        const __m256 t = _mm256_floor_ps(_mm256_add_ps(_mm256_div_ps(_mm256_loadu_ps(log_ws + j), r), b));
+
+        // Lanes 0-3 and 4-7 in double precision
+        const __m128 a_lo = calc_a_avx2(_mm256_castps256_ps128(t), _mm256_castps256_ps128(r),
+                                        _mm256_castps256_ps128(b), _mm256_castps256_ps128(log_c));
+        const __m128 a_hi = calc_a_avx2(_mm256_extractf128_ps(t, 1), _mm256_extractf128_ps(r, 1),
+                                        _mm256_extractf128_ps(b, 1), _mm256_extractf128_ps(log_c, 1));
+        const __m256 a = _mm256_insertf128_ps(_mm256_castps128_ps256(a_lo), a_hi, 1);
+
+        const __m256 lt = _mm256_cmp_ps(a, vmin, _CMP_LT_OQ);
+        vmin = _mm256_blendv_ps(vmin, a, lt);
+        vmin_id = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(vmin_id), _mm256_castsi256_ps(vid), lt));
+        vid = _mm256_add_epi32(vid, _mm256_set1_epi32(8));
+    }
+
+    alignas(32) float mins[8];
+    alignas(32) uint32_t ids[8];
+    _mm256_store_ps(mins, vmin);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(ids), vmin_id);
+    argmin_lanes(mins, ids, 8, min_a, min_id);
+    argmin_scalar(log_ws, R, logC, B, n, dat_dim, min_a, min_id);
+}
+
+// Some versions of GCC falsely warn about the undefined vectors in AVX-512 intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f"))) inline __m256 calc_a_avx512(__m256 t, __m256 r, __m256 b, __m256 log_c) {
+    const __m512d u = _mm512_sub_pd(_mm512_add_pd(_mm512_cvtps_pd(t), _mm512_set1_pd(1.0)), _mm512_cvtps_pd(b));
+    return _mm512_cvtpd_ps(_mm512_sub_pd(_mm512_cvtps_pd(log_c), _mm512_mul_pd(_mm512_cvtps_pd(r), u)));
+}
+
+__attribute__((target("avx512f"))) inline __m256 get_half_avx512(__m512 x, int hi) {
+    return hi ? _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(x), 1)) : _mm512_castps512_ps256(x);
+}
+
+__attribute__((target("avx512f"))) inline void argmin_avx512(const float* log_ws, const float* R, const float* logC,
+                                                              const float* B, size_t dat_dim, float& min_a,
+                                                              uint32_t& min_id) {
+    const size_t n = dat_dim / 16 * 16;
+
+    __m512 vmin = _mm512_set1_ps(numeric_limits<float>::max());
+    __m512i vmin_id = _mm512_setzero_si512();
+    __m512i vid = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    for (size_t j = 0; j < n; j += 16) {
+        const __m512 r = _mm512_loadu_ps(R + j);
+        const __m512 b = _mm512_loadu_ps(B + j);
+        const __m512 log_c = _mm512_loadu_ps(logC + j);
+        const __m512 t = _mm512_roundscale_ps(_mm512_add_ps(_mm512_div_ps(_mm512_loadu_ps(log_ws + j), r), b),
+                                              _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+
+        // Lanes 0-7 and 8-15 in double precision
+        const __m256 a_lo = calc_a_avx512(get_half_avx512(t, 0), get_half_avx512(r, 0), get_half_avx512(b, 0),
+                                          get_half_avx512(log_c, 0));
+        const __m256 a_hi = calc_a_avx512(get_half_avx512(t, 1), get_half_avx512(r, 1), get_half_avx512(b, 1),
+                                          get_half_avx512(log_c, 1));
+        const __m512 a = _mm512_castpd_ps(
+            _mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(a_lo)), _mm256_castps_pd(a_hi), 1));
+
+        const __mmask16 lt = _mm512_cmp_ps_mask(a, vmin, _CMP_LT_OQ);
+        vmin = _mm512_mask_mov_ps(vmin, lt, a);
+        vmin_id = _mm512_mask_mov_epi32(vmin_id, lt, vid);
+        vid = _mm512_add_epi32(vid, _mm512_set1_epi32(16));
+    }
+
+    alignas(64) float mins[16];
+    alignas(64) uint32_t ids[16];
+    _mm512_store_ps(mins, vmin);
+    _mm512_store_si512(ids, vmin_id);
+    argmin_lanes(mins, ids, 16, min_a, min_id);
+    argmin_scalar(log_ws, R, logC, B, n, dat_dim, min_a, min_id);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+// Computes cws_dim samples of a dense vector of dat_dim dimensions with the given instruction set
+inline void sketch_dense(const random_matrix& mat, const float* data_vec, size_t dat_dim, size_t cws_dim,
+                         uint32_t* min_ids, float* min_as, simd_level level) {
+    thread_local vector<float> log_ws;
+    log_ws.resize(dat_dim);
+    for (size_t j = 0; j < dat_dim; ++j) {
+        log_ws[j] = log10(data_vec[j]);
+    }
+
+    for (size_t i = 0; i < cws_dim; ++i) {
+        const float* R = mat.r_row(i);
+        const float* logC = mat.log_c_row(i);
+        const float* B = mat.b_row(i);
+
+        float min_a = numeric_limits<float>::max();
+        uint32_t min_id = 0;
+
+        switch (level) {
+#ifdef CWS_X86
+            case simd_level::avx512:
+                argmin_avx512(log_ws.data(), R, logC, B, dat_dim, min_a, min_id);
+                break;
+            case simd_level::avx2:
+                argmin_avx2(log_ws.data(), R, logC, B, dat_dim, min_a, min_id);
+                break;
+            case simd_level::sse4:
+                argmin_sse4(log_ws.data(), R, logC, B, dat_dim, min_a, min_id);
+                break;
+#endif
+            default:
+                argmin_scalar(log_ws.data(), R, logC, B, 0, dat_dim, min_a, min_id);
+                break;
+        }
+
+        min_ids[i] = min_id;
+        min_as[i] = min_a;
+    }
+}
+
+}  // namespace cws
@@ -2,33 +2,65 @@
 
 #include "cmdline.h"
 #include "misc.hpp"
+#include "sketch_format.hpp"
+
+template <class SampleType>
+void print_vecs(const string& input_fn, size_t num) {
+    ifstream ifs = make_ifstream(input_fn);
+
+    for (size_t i = 0; i < num; ++i) {
+        auto dim = read_value<uint32_t>(ifs);
+        if (ifs.eof()) {
+            break;
+        }
+        for (size_t j = 0; j < dim; ++j) {
+            auto v = read_value<SampleType>(ifs);
+            cout << static_cast<uint32_t>(v) << ' ';
+        }
+        cout << '\n';
+    }
+}
 
 int main(int argc, char** argv) {
     ios::sync_with_stdio(false);
 
     cmdline::parser p;
-    p.add<string>("input_fn", 'i', "input file name of cws sketches (in bvecs format)", true);
+    p.add<string>("input_fn", 'i', "input file name of cws sketches (in bvecs/svecs/ivecs or cws format)", true);
     p.add<size_t>("num", 'n', "number of sketches printed", false, 5);
     p.parse_check(argc, argv);
 
     auto input_fn = p.get<string>("input_fn");
     auto num = p.get<size_t>("num");
 
-    if (get_ext(input_fn) != "bvecs") {
-        cerr << "Error: invalid format file" << endl;
-        return 1;
-    }
+    if (get_ext(input_fn) == "cws") {
+        sketch_format::mapped_sketches sketches(input_fn);
+        const sketch_format::header_t& header = sketches.header();
 
-    ifstream ifs = make_ifstream(input_fn);
+        cout << "# " << header.num_vecs << " sketches of " << header.cws_dim << " samples in " << header.bits
+             << " bits (seed=" << header.seed << ", generalized=" << bool(header.flags & sketch_format::GENERALIZED_FLAG)
+             << ", matrix_free=" << bool(header.flags & sketch_format::MATRIX_FREE_FLAG)
+             << ", method=" << sketch_format::get_method_name(header.flags) << ", samples=[" << header.first_sample
+             << "," << header.first_sample + header.cws_dim << ") of " << header.total_dim << ")\n";
 
-    for (size_t i = 0; i < num; ++i) {
-        auto dim = read_value<uint32_t>(ifs);
-        for (size_t j = 0; j < dim; ++j) {
-            auto v = read_value<uint8_t>(ifs);
-            cout << static_cast<uint32_t>(v) << ' ';
+        for (size_t i = 0; i < min<size_t>(num, sketches.size()); ++i) {
+            for (size_t j = 0; j < header.cws_dim; ++j) {
+                cout << sketches.get(i, j) << ' ';
+            }
+            cout << '\n';
         }
-        cout << '\n';
+        return 0;
+    }
+
+    if (get_ext(input_fn) == "bvecs") {
+        print_vecs<uint8_t>(input_fn, num);
+    } else if (get_ext(input_fn) == "svecs") {
+        print_vecs<uint16_t>(input_fn, num);
+    } else if (get_ext(input_fn) == "ivecs") {
+        print_vecs<uint32_t>(input_fn, num);
+    } else {
+        cerr << "Error: invalid format file" << endl;
+        return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
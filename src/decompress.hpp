@@ -0,0 +1,332 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef CWS_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CWS_WITH_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef CWS_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+/****
+ *  Transparent reading of gzip/bzip2/zstd-compressed input files
+ *
+ *  A dedicated thread decompresses the file into a ring of blocks ahead of the reader,
+ *  so decompression overlaps with parsing and sampling on the other threads.
+ */
+
+enum class compression_type : int { none = 0, gzip = 1, bzip2 = 2, zstd = 3 };
+
+// Compression of a file by its extension (.gz, .bz2 or .zst)
+inline compression_type get_compression(const string& filepath) {
+    auto ends_with = [&](const string& ext) {
+        return filepath.size() > ext.size() and filepath.compare(filepath.size() - ext.size(), ext.size(), ext) == 0;
+    };
+    if (ends_with(".gz")) {
+        return compression_type::gzip;
+    } else if (ends_with(".bz2")) {
+        return compression_type::bzip2;
+    } else if (ends_with(".zst")) {
+        return compression_type::zstd;
+    }
+    return compression_type::none;
+}
+
+// Removes the extension of the compression, e.g., to tell the format of "base.fvecs.gz"
+inline string strip_compression_ext(const string& filepath) {
+    switch (get_compression(filepath)) {
+        case compression_type::gzip:
+            return filepath.substr(0, filepath.size() - 3);
+        case compression_type::bzip2:
+        case compression_type::zstd:
+            return filepath.substr(0, filepath.size() - 4);
+        default:
+            return filepath;
+    }
+}
+
+class decompress_streambuf : public streambuf {
+  public:
+    static constexpr size_t BLOCK_BYTES = size_t(1) << 20;
+    static constexpr size_t NUM_BLOCKS = 4;
+
+    decompress_streambuf(const string& filepath, compression_type type) : fn_(filepath), ring_(NUM_BLOCKS) {
+        for (block_type& block : ring_) {
+            block.data.resize(BLOCK_BYTES);
+        }
+        open(type);
+        worker_ = thread([this] { decompress(); });
+    }
+
+    ~decompress_streambuf() override {
+        {
+            lock_guard<mutex> lock(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        worker_.join();
+        close();
+    }
+
+    decompress_streambuf(const decompress_streambuf&) = delete;
+    decompress_streambuf& operator=(const decompress_streambuf&) = delete;
+
+  protected:
+    int_type underflow() override {
+        unique_lock<mutex> lock(mtx_);
+        if (eback() != nullptr) {
+            // Release the block read up
+            consumed_ += 1;
+            setg(nullptr, nullptr, nullptr);
+            cv_.notify_all();
+        }
+        cv_.wait(lock, [this] { return filled_ != consumed_ or done_; });
+        if (filled_ == consumed_) {
+            if (!error_.empty()) {
+                cerr << "error: " << error_ << ": " << fn_ << endl;
+                exit(1);
+            }
+            return traits_type::eof();
+        }
+        block_type& block = ring_[consumed_ % NUM_BLOCKS];
+        setg(block.data.data(), block.data.data(), block.data.data() + block.size);
+        return traits_type::to_int_type(*gptr());
+    }
+
+  private:
+    struct block_type {
+        vector<char> data;
+        size_t size = 0;
+    };
+
+    string fn_;
+    compression_type type_ = compression_type::none;
+#ifdef CWS_WITH_ZLIB
+    gzFile gz_ = nullptr;
+#endif
+    FILE* fp_ = nullptr;  // for bzip2 and zstd
+#ifdef CWS_WITH_BZIP2
+    BZFILE* bz_ = nullptr;
+#endif
+#ifdef CWS_WITH_ZSTD
+    ZSTD_DCtx* zstd_ = nullptr;
+    vector<char> zstd_in_;
+    ZSTD_inBuffer zstd_in_buf_ = {nullptr, 0, 0};
+    size_t zstd_ret_ = 0;        // zero if the last frame read is complete
+    bool zstd_pending_ = false;  // whether the decoder may hold output not flushed yet
+#endif
+
+    // Blocks [consumed_, filled_) modulo NUM_BLOCKS are decompressed and not read up yet
+    vector<block_type> ring_;
+    size_t consumed_ = 0;
+    size_t filled_ = 0;
+    bool done_ = false;
+    bool stop_ = false;
+    string error_;
+    mutex mtx_;
+    condition_variable cv_;
+    thread worker_;
+
+    void open(compression_type type) {
+        type_ = type;
+        if (type == compression_type::gzip) {
+#ifdef CWS_WITH_ZLIB
+            gz_ = gzopen(fn_.c_str(), "rb");
+            if (gz_ == nullptr) {
+                cerr << "open error: " << fn_ << endl;
+                exit(1);
+            }
+            gzbuffer(gz_, 1 << 17);
+            return;
+#endif
+        } else if (type == compression_type::bzip2) {
+#ifdef CWS_WITH_BZIP2
+            fp_ = fopen(fn_.c_str(), "rb");
+            if (fp_ == nullptr) {
+                cerr << "open error: " << fn_ << endl;
+                exit(1);
+            }
+            int bzerror = BZ_OK;
+            bz_ = BZ2_bzReadOpen(&bzerror, fp_, 0, 0, nullptr, 0);
+            if (bzerror != BZ_OK) {
+                cerr << "error: bzip2 cannot be read: " << fn_ << endl;
+                exit(1);
+            }
+            return;
+#endif
+        } else if (type == compression_type::zstd) {
+#ifdef CWS_WITH_ZSTD
+            fp_ = fopen(fn_.c_str(), "rb");
+            if (fp_ == nullptr) {
+                cerr << "open error: " << fn_ << endl;
+                exit(1);
+            }
+            zstd_ = ZSTD_createDCtx();
+            zstd_in_.resize(ZSTD_DStreamInSize());
+            zstd_in_buf_ = {zstd_in_.data(), 0, 0};
+            return;
+#endif
+        }
+        cerr << "error: the compression of " << fn_ << " is not supported in this build" << endl;
+        exit(1);
+    }
+
+    void close() {
+#ifdef CWS_WITH_ZLIB
+        if (gz_ != nullptr) {
+            gzclose(gz_);
+        }
+#endif
+#ifdef CWS_WITH_BZIP2
+        if (bz_ != nullptr) {
+            int bzerror = BZ_OK;
+            BZ2_bzReadClose(&bzerror, bz_);
+        }
+#endif
+#ifdef CWS_WITH_ZSTD
+        if (zstd_ != nullptr) {
+            ZSTD_freeDCtx(zstd_);
+        }
+#endif
+        if (fp_ != nullptr) {
+            fclose(fp_);
+        }
+    }
+
+    // Decompresses up to size bytes into buf, returning the bytes read, zero at the end, or -1 on an error
+    long read(char* buf, size_t size) {
+#ifdef CWS_WITH_ZLIB
+        if (type_ == compression_type::gzip) {
+            // Concatenated gzip members are read through
+            return gzread(gz_, buf, static_cast<unsigned>(size));
+        }
+#endif
+#ifdef CWS_WITH_BZIP2
+        if (type_ == compression_type::bzip2) {
+            long bytes = 0;
+            while (bytes == 0 and bz_ != nullptr) {
+                int bzerror = BZ_OK;
+                bytes = BZ2_bzRead(&bzerror, bz_, buf, static_cast<int>(size));
+                if (bzerror == BZ_STREAM_END) {
+                    // Continue to the next stream of multi-stream files (e.g., made by pbzip2)
+                    void* unused = nullptr;
+                    int num_unused = 0;
+                    BZ2_bzReadGetUnused(&bzerror, bz_, &unused, &num_unused);
+                    const vector<char> rest(static_cast<char*>(unused), static_cast<char*>(unused) + num_unused);
+                    BZ2_bzReadClose(&bzerror, bz_);
+                    bz_ = nullptr;
+                    if (num_unused != 0 or ungetc(getc(fp_), fp_) != EOF) {
+                        bz_ = BZ2_bzReadOpen(&bzerror, fp_, 0, 0, const_cast<char*>(rest.data()), num_unused);
+                        if (bzerror != BZ_OK) {
+                            return -1;
+                        }
+                    }
+                } else if (bzerror != BZ_OK) {
+                    return -1;
+                }
+            }
+            return bytes;
+        }
+#endif
+#ifdef CWS_WITH_ZSTD
+        if (type_ == compression_type::zstd) {
+            // Concatenated frames are read through
+            ZSTD_outBuffer out = {buf, size, 0};
+            while (true) {
+                if (zstd_in_buf_.pos == zstd_in_buf_.size and !zstd_pending_) {
+                    zstd_in_buf_.size = fread(zstd_in_.data(), 1, zstd_in_.size(), fp_);
+                    zstd_in_buf_.pos = 0;
+                    if (zstd_in_buf_.size == 0) {
+                        // The file must not end in the middle of a frame
+                        return ferror(fp_) or zstd_ret_ != 0 ? -1 : 0;
+                    }
+                }
+                const size_t in_pos = zstd_in_buf_.pos;
+                const size_t ret = ZSTD_decompressStream(zstd_, &out, &zstd_in_buf_);
+                if (ZSTD_isError(ret)) {
+                    return -1;
+                }
+                if (zstd_in_buf_.pos != in_pos or out.pos != 0) {
+                    zstd_ret_ = ret;
+                }
+                zstd_pending_ = out.pos == out.size;
+                if (out.pos != 0) {
+                    return static_cast<long>(out.pos);
+                }
+            }
+        }
+#endif
+        (void)buf;
+        (void)size;
+        return -1;
+    }
+
+    // Fills free blocks of the ring in order until the end of the file
+    void decompress() {
+        for (size_t pos = 0;; ++pos) {
+            {
+                unique_lock<mutex> lock(mtx_);
+                cv_.wait(lock, [&] { return pos - consumed_ < NUM_BLOCKS or stop_; });
+                if (stop_) {
+                    return;
+                }
+            }
+
+            // The block is not touched by the reader until filled
+            block_type& block = ring_[pos % NUM_BLOCKS];
+            block.size = 0;
+            long bytes = 1;
+            while (block.size < BLOCK_BYTES) {
+                bytes = read(block.data.data() + block.size, BLOCK_BYTES - block.size);
+                if (bytes <= 0) {
+                    break;
+                }
+                block.size += static_cast<size_t>(bytes);
+            }
+
+            // The last block and the end are published at once, so the reader never sees the end first
+            bool done = false;
+            {
+                lock_guard<mutex> lock(mtx_);
+                if (block.size != 0) {
+                    filled_ += 1;
+                }
+                if (bytes <= 0) {
+                    if (bytes < 0) {
+                        error_ = "broken compressed data";
+                    }
+                    done_ = true;
+                    done = true;
+                }
+            }
+            cv_.notify_all();
+            if (done) {
+                return;
+            }
+        }
+    }
+};
+
+// Input stream owning its decompress_streambuf
+class decompress_istream : public istream {
+  public:
+    decompress_istream(const string& filepath, compression_type type) : istream(nullptr), buf_(filepath, type) {
+        rdbuf(&buf_);
+    }
+
+  private:
+    decompress_streambuf buf_;
+};
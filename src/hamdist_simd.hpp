@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstdint>
+
+#include "simd.hpp"
+
+/****
+ *  SIMD kernels counting mismatched samples between two sketches of 8-bit samples.
+ *
+ *  Bytes are compared a vector register at a time, and the mismatches are counted by popcount
+ *  on the comparison mask. The kernels are specialized for common dimensions (Dim = 32/64/128/256),
+ *  whose loops are fully unrolled, and Dim = 0 handles any dimension given at runtime.
+ */
+namespace hamdist {
+
+inline uint32_t hamdist_scalar(const uint8_t* x, const uint8_t* y, uint32_t dim) {
+    uint32_t errs = 0;
+    for (uint32_t i = 0; i < dim; ++i) {
+        errs += x[i] != y[i];
+    }
+    return errs;
+}
+
+#ifdef CWS_X86
+
+// A dimension not divisible by the width is covered by an overlapping load of the last bytes,
+// whose bits of the bytes compared already are masked out of the comparison mask
+template <uint32_t Dim>
+__attribute__((target("sse4.1"))) inline uint32_t hamdist_sse4(const uint8_t* x, const uint8_t* y, uint32_t dim) {
+    const uint32_t d = Dim != 0 ? Dim : dim;
+    if (d < 16) {
+        return hamdist_scalar(x, y, d);
+    }
+    const uint32_t n = d / 16 * 16;
+    uint32_t neqs = 0;
+    for (uint32_t i = 0; i < n; i += 16) {
+        const __m128i vx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        const __m128i vy = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + i));
+        neqs += static_cast<uint32_t>(__builtin_popcount(~_mm_movemask_epi8(_mm_cmpeq_epi8(vx, vy)) & 0xFFFF));
+    }
+    if (n != d) {
+        const __m128i vx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + d - 16));
+        const __m128i vy = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + d - 16));
+        const uint32_t fresh = 0xFFFFu << (16 - (d - n));
+        neqs += static_cast<uint32_t>(__builtin_popcount(~_mm_movemask_epi8(_mm_cmpeq_epi8(vx, vy)) & fresh & 0xFFFF));
+    }
+    return neqs;
+}
+
+template <uint32_t Dim>
+__attribute__((target("avx2"))) inline uint32_t hamdist_avx2(const uint8_t* x, const uint8_t* y, uint32_t dim) {
+    const uint32_t d = Dim != 0 ? Dim : dim;
+    if (d < 32) {
+        return hamdist_sse4<Dim>(x, y, dim);
+    }
+    const uint32_t n = d / 32 * 32;
+    uint32_t neqs = 0;
+    for (uint32_t i = 0; i < n; i += 32) {
+        const __m256i vx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+        const __m256i vy = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + i));
+        neqs += static_cast<uint32_t>(
+            __builtin_popcount(~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(vx, vy)))));
+    }
+    if (n != d) {
+        const __m256i vx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + d - 32));
+        const __m256i vy = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + d - 32));
+        const uint32_t fresh = ~uint32_t(0) << (32 - (d - n));
+        neqs += static_cast<uint32_t>(
+            __builtin_popcount(~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(vx, vy))) & fresh));
+    }
+    return neqs;
+}
+
+// The last bytes fewer than 64 are loaded with a mask, which never faults beyond the sketches.
+// Dimensions of 32 bytes fit in AVX2 registers, which are compared faster than with a masked load.
+template <uint32_t Dim>
+__attribute__((target("avx2,avx512f,avx512bw"))) inline uint32_t hamdist_avx512(const uint8_t* x, const uint8_t* y,
+                                                                                 uint32_t dim) {
+    if constexpr (Dim != 0 and Dim % 64 != 0) {
+        return hamdist_avx2<Dim>(x, y, dim);
+    } else {
+        const uint32_t d = Dim != 0 ? Dim : dim;
+        const uint32_t n = d / 64 * 64;
+        uint32_t neqs = 0;
+        for (uint32_t i = 0; i < n; i += 64) {
+            const __m512i vx = _mm512_loadu_si512(x + i);
+            const __m512i vy = _mm512_loadu_si512(y + i);
+            neqs += static_cast<uint32_t>(__builtin_popcountll(_mm512_cmpneq_epi8_mask(vx, vy)));
+        }
+        if (n != d) {
+            const __mmask64 mask = ~uint64_t(0) >> (64 - (d - n));
+            const __m512i vx = _mm512_maskz_loadu_epi8(mask, x + n);
+            const __m512i vy = _mm512_maskz_loadu_epi8(mask, y + n);
+            neqs += static_cast<uint32_t>(__builtin_popcountll(_mm512_cmpneq_epi8_mask(vx, vy)));
+        }
+        return neqs;
+    }
+}
+
+#endif
+
+// Kernel of the instruction set for sketches of Dim samples (or of dim samples if Dim = 0)
+template <simd_level Level, uint32_t Dim>
+struct kernel {
+    uint32_t dim;
+
+    uint32_t operator()(const uint8_t* x, const uint8_t* y) const {
+#ifdef CWS_X86
+        if constexpr (Level == simd_level::avx512) {
+            return hamdist_avx512<Dim>(x, y, dim);
+        } else if constexpr (Level == simd_level::avx2) {
+            return hamdist_avx2<Dim>(x, y, dim);
+        } else if constexpr (Level == simd_level::sse4) {
+            return hamdist_sse4<Dim>(x, y, dim);
+        }
+#endif
+        return hamdist_scalar(x, y, Dim != 0 ? Dim : dim);
+    }
+};
+
+template <simd_level Level, class Fn>
+inline auto dispatch_dim(uint32_t dim, Fn&& fn) {
+    switch (dim) {
+        case 32:
+            return fn(kernel<Level, 32>{dim});
+        case 64:
+            return fn(kernel<Level, 64>{dim});
+        case 128:
+            return fn(kernel<Level, 128>{dim});
+        case 256:
+            return fn(kernel<Level, 256>{dim});
+        default:
+            return fn(kernel<Level, 0>{dim});
+    }
+}
+
+// Calls fn with the kernel of the instruction set specialized for the dimension,
+// so that the kernel is inlined into the loop of fn over sketches
+template <class Fn>
+inline auto dispatch(simd_level level, uint32_t dim, Fn&& fn) {
+    switch (level) {
+#ifdef CWS_X86
+        case simd_level::avx512:
+            return dispatch_dim<simd_level::avx512>(dim, fn);
+        case simd_level::avx2:
+            return dispatch_dim<simd_level::avx2>(dim, fn);
+        case simd_level::sse4:
+            return dispatch_dim<simd_level::sse4>(dim, fn);
+#endif
+        default:
+            return dispatch_dim<simd_level::scalar>(dim, fn);
+    }
+}
+
+}  // namespace hamdist
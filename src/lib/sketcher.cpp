@@ -0,0 +1,321 @@
+#include "../sketcher.hpp"
+
+#include <variant>
+
+#include "../cws.hpp"
+#include "../cws_model.hpp"
+#include "../cws_simd.hpp"
+
+namespace cws {
+
+struct sketcher::impl {
+    variant<random_matrix, feature_major_matrix, hashed_matrix, dart_minhash> mat;
+    matrix_type type = matrix_type::sample_major;
+    method_type method = method_type::icws;
+    i2cws_params second;
+    size_t cws_dim = 0;
+    simd_level level = detect_simd_level();
+    float sparse_density = 0.15;
+};
+
+namespace {
+
+// Scratch of the hash values for callers not requiring them, reused across calls in each thread
+float* get_scratch_as(float* min_as, size_t k, size_t cws_dim) {
+    if (min_as != nullptr) {
+        return &min_as[k * cws_dim];
+    }
+    thread_local vector<float> scratch;
+    scratch.resize(cws_dim);
+    return scratch.data();
+}
+
+// Random parameters drawn for the method, where I2CWS chooses features in the same manner as ICWS
+param_type get_param_type(method_type method) {
+    return method == method_type::pcws ? param_type::pcws : param_type::icws;
+}
+
+// Samples [beg_sample, end_sample) of the vectors [beg_vec, end_vec) as a unit of work
+struct work_item {
+    size_t beg_vec;
+    size_t end_vec;
+    size_t beg_sample;
+    size_t end_sample;
+};
+
+// Work items per thread, so that dynamic scheduling absorbs errors of the estimated costs
+constexpr size_t ITEMS_PER_THREAD = 8;
+
+// Partitions vectors into work items of about the same cost, estimated by the number of features plus
+// vec_cost per vector. A vector costing more than an item is split into ranges of samples if splittable.
+// The items are stored into the given vector, which keeps its capacity across calls.
+void partition_work(size_t num_vecs, const size_t* offsets, size_t cws_dim, size_t vec_cost, bool splittable,
+                    size_t num_threads, vector<work_item>& items) {
+    items.clear();
+    if (num_threads <= 1) {
+        items.push_back({0, num_vecs, 0, cws_dim});
+        return;
+    }
+
+    auto get_cost = [&](size_t k) { return offsets[k + 1] - offsets[k] + vec_cost; };
+    const size_t total_cost = offsets[num_vecs] - offsets[0] + vec_cost * num_vecs;
+    const size_t item_cost = max<size_t>(total_cost / (num_threads * ITEMS_PER_THREAD), 1);
+
+    size_t beg = 0, cost = 0;
+    for (size_t k = 0; k < num_vecs; ++k) {
+        if (splittable and item_cost < get_cost(k) and 1 < cws_dim) {
+            if (beg < k) {
+                items.push_back({beg, k, 0, cws_dim});
+            }
+            const size_t num_parts = min(cws_dim, (get_cost(k) + item_cost - 1) / item_cost);
+            for (size_t part = 0; part < num_parts; ++part) {
+                items.push_back({k, k + 1, part * cws_dim / num_parts, (part + 1) * cws_dim / num_parts});
+            }
+            beg = k + 1;
+            cost = 0;
+            continue;
+        }
+        cost += get_cost(k);
+        if (item_cost <= cost) {
+            items.push_back({beg, k + 1, 0, cws_dim});
+            beg = k + 1;
+            cost = 0;
+        }
+    }
+    if (beg < num_vecs) {
+        items.push_back({beg, num_vecs, 0, cws_dim});
+    }
+}
+
+template <class Matrix>
+void sketch_sparse_batch(const Matrix& mat, size_t cws_dim, const i2cws_params* second, size_t num_vecs,
+                         const size_t* offsets, const uint32_t* ids, const float* weights, uint32_t* min_ids,
+                         float* min_as, thread_stats* stats) {
+    // DartMinHash throws darts for all the samples at once, costing O(cws_dim log cws_dim) per vector
+    constexpr bool splittable = !is_same_v<Matrix, dart_minhash>;
+    const size_t num_threads = omp_get_max_threads();
+
+    // The scratch of the calling thread is reused across calls, referred to from the threads of the team
+    thread_local vector<work_item> scratch_items;
+    thread_local vector<double> scratch_busy_sec;
+    vector<work_item>& items = scratch_items;
+    vector<double>& busy_sec = scratch_busy_sec;
+    partition_work(num_vecs, offsets, cws_dim, splittable ? 1 : cws_dim, splittable, num_threads, items);
+    if (stats != nullptr) {
+        busy_sec.assign(num_threads, 0.0);
+    }
+    auto start_tp = chrono::steady_clock::now();
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_t w = 0; w < items.size(); ++w) {
+        const auto item_tp = stats != nullptr ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+        const work_item& item = items[w];
+        const size_t num_samples = item.end_sample - item.beg_sample;
+
+        for (size_t k = item.beg_vec; k < item.end_vec; ++k) {
+            const sparse_view data_vec(ids + offsets[k], weights == nullptr ? nullptr : weights + offsets[k],
+                                       offsets[k + 1] - offsets[k]);
+            uint32_t* vec_min_ids = &min_ids[k * cws_dim + item.beg_sample];
+            float* vec_min_as = get_scratch_as(min_as, k, cws_dim) + item.beg_sample;
+            if constexpr (splittable) {
+                sketch_sparse(mat, data_vec, num_samples, vec_min_ids, vec_min_as, item.beg_sample);
+            } else {
+                sketch_sparse(mat, data_vec, num_samples, vec_min_ids, vec_min_as);
+            }
+            if (second != nullptr) {
+                finalize_i2cws(*second, data_vec, num_samples, vec_min_ids, item.beg_sample);
+            }
+        }
+
+        if (stats != nullptr) {
+            busy_sec[omp_get_thread_num()] +=
+                chrono::duration<double>(chrono::steady_clock::now() - item_tp).count();
+        }
+    }
+
+    if (stats != nullptr) {
+        stats->add(busy_sec, chrono::duration<double>(chrono::steady_clock::now() - start_tp).count());
+    }
+}
+
+template <class Matrix>
+size_t sketch_dense_batch(const Matrix& mat, size_t cws_dim, const i2cws_params* second, simd_level level,
+                          float sparse_density, size_t num_vecs, size_t dat_dim, const float* vecs,
+                          uint32_t* min_ids, float* min_as) {
+    size_t num_sparse = 0;
+
+#pragma omp parallel for reduction(+ : num_sparse)
+    for (size_t k = 0; k < num_vecs; ++k) {
+        const float* data_vec = &vecs[k * dat_dim];
+        uint32_t* vec_min_ids = &min_ids[k * cws_dim];
+        float* vec_min_as = get_scratch_as(min_as, k, cws_dim);
+
+        // Zero (or negative) features are never sampled, so they can be skipped exactly
+        thread_local vector<ascii_format::elem_t<true>> sparse_vec;
+        sparse_vec.clear();
+        for (size_t j = 0; j < dat_dim; ++j) {
+            if (data_vec[j] > 0.0) {
+                sparse_vec.push_back({uint32_t(j), data_vec[j]});
+            }
+        }
+
+        if constexpr (is_same_v<Matrix, random_matrix>) {
+            if (sparse_vec.size() < sparse_density * dat_dim) {
+                sketch_sparse(mat, sparse_vec, cws_dim, vec_min_ids, vec_min_as);
+                num_sparse += 1;
+            } else {
+                sketch_dense(mat, data_vec, dat_dim, cws_dim, vec_min_ids, vec_min_as, level);
+            }
+        } else {
+            // Otherwise, sampling of each feature is costly enough to always skip zeros
+            sketch_sparse(mat, sparse_vec, cws_dim, vec_min_ids, vec_min_as);
+            num_sparse += 1;
+        }
+
+        if (second != nullptr) {
+            for (size_t i = 0; i < cws_dim; ++i) {
+                vec_min_ids[i] = (*second)(i, vec_min_ids[i], max(data_vec[vec_min_ids[i]], 0.0f));
+            }
+        }
+    }
+
+    return num_sparse;
+}
+
+}  // namespace
+
+sketcher::sketcher() : impl_(make_unique<impl>()) {}
+
+sketcher::sketcher(size_t dat_dim, size_t cws_dim, size_t seed, matrix_type type, method_type method)
+    : sketcher() {
+    impl_->type = type;
+    impl_->method = method;
+    impl_->second = i2cws_params(seed);
+    impl_->cws_dim = cws_dim;
+    if (method == method_type::dart_minhash) {
+        impl_->type = matrix_type::matrix_free;
+        impl_->mat.emplace<dart_minhash>(seed);
+        return;
+    }
+    const param_type params = get_param_type(method);
+    switch (type) {
+        case matrix_type::sample_major:
+            impl_->mat.emplace<random_matrix>(dat_dim, cws_dim, seed, params);
+            break;
+        case matrix_type::feature_major:
+            impl_->mat.emplace<feature_major_matrix>(dat_dim, cws_dim, seed, params);
+            break;
+        case matrix_type::matrix_free:
+            impl_->mat.emplace<hashed_matrix>(seed, params);
+            break;
+    }
+}
+
+sketcher::sketcher(const string& model_fn, size_t cws_dim) : sketcher() {
+    const cws_model::header_t header = cws_model::load_header(model_fn);
+    impl_->method = static_cast<method_type>(header.method);
+    if (impl_->method == method_type::dart_minhash or method_type::i2cws < impl_->method) {
+        cerr << "error: invalid sampling method of the model file: " << model_fn << endl;
+        exit(1);
+    }
+    impl_->second = i2cws_params(header.seed);
+
+    size_t model_cws_dim = 0;
+    if (header.layout == cws_model::FEATURE_MAJOR_LAYOUT) {
+        auto& mat = impl_->mat.emplace<feature_major_matrix>(cws_model::load<feature_major_matrix>(model_fn));
+        model_cws_dim = mat.cws_dim();
+        impl_->type = matrix_type::feature_major;
+    } else {
+        auto& mat = impl_->mat.emplace<random_matrix>(cws_model::load<random_matrix>(model_fn));
+        model_cws_dim = mat.cws_dim();
+    }
+
+    // The first cws_dim samples of the model are the same as those generated with cws_dim
+    if (model_cws_dim < cws_dim) {
+        cerr << "error: cws_dim exceeds that of the model (" << model_cws_dim << ")" << endl;
+        exit(1);
+    }
+    impl_->cws_dim = cws_dim == 0 ? model_cws_dim : cws_dim;
+}
+
+sketcher::~sketcher() = default;
+
+sketcher::sketcher(sketcher&&) noexcept = default;
+sketcher& sketcher::operator=(sketcher&&) noexcept = default;
+
+void sketcher::save(const string& model_fn) const {
+    visit(
+        [&](const auto& mat) {
+            using matrix_t = decay_t<decltype(mat)>;
+            if constexpr (is_same_v<matrix_t, hashed_matrix> or is_same_v<matrix_t, dart_minhash>) {
+                cerr << "error: random matrix data of matrix_free or dart_minhash cannot be saved" << endl;
+                exit(1);
+            } else {
+                cws_model::save(model_fn, mat, static_cast<uint32_t>(impl_->method));
+            }
+        },
+        impl_->mat);
+}
+
+void sketcher::set_simd_level(simd_level level) {
+    impl_->level = level;
+}
+
+void sketcher::set_sparse_density(float density) {
+    impl_->sparse_density = density;
+}
+
+void sketcher::sketch_sparse(size_t num_vecs, const size_t* offsets, const uint32_t* ids, const float* weights,
+                             uint32_t* min_ids, float* min_as, thread_stats* stats) const {
+    const i2cws_params* second = impl_->method == method_type::i2cws ? &impl_->second : nullptr;
+    visit(
+        [&](const auto& mat) {
+            sketch_sparse_batch(mat, impl_->cws_dim, second, num_vecs, offsets, ids, weights, min_ids, min_as, stats);
+        },
+        impl_->mat);
+}
+
+size_t sketcher::sketch_dense(size_t num_vecs, size_t dat_dim, const float* vecs, uint32_t* min_ids,
+                              float* min_as) const {
+    if (this->dat_dim() < dat_dim) {
+        cerr << "error: dat_dim of dense vectors exceeds that of random matrix data" << endl;
+        exit(1);
+    }
+    const i2cws_params* second = impl_->method == method_type::i2cws ? &impl_->second : nullptr;
+    return visit(
+        [&](const auto& mat) {
+            return sketch_dense_batch(mat, impl_->cws_dim, second, impl_->level, impl_->sparse_density,
+                                      num_vecs, dat_dim, vecs, min_ids, min_as);
+        },
+        impl_->mat);
+}
+
+size_t sketcher::dat_dim() const {
+    return visit([](const auto& mat) { return size_t(mat.dat_dim()); }, impl_->mat);
+}
+
+size_t sketcher::cws_dim() const {
+    return impl_->cws_dim;
+}
+
+size_t sketcher::seed() const {
+    return visit([](const auto& mat) { return size_t(mat.seed()); }, impl_->mat);
+}
+
+matrix_type sketcher::type() const {
+    return impl_->type;
+}
+
+method_type sketcher::method() const {
+    return impl_->method;
+}
+
+simd_level sketcher::get_simd_level() const {
+    return impl_->level;
+}
+
+size_t sketcher::memory_in_bytes() const {
+    return visit([](const auto& mat) { return size_t(mat.memory_in_bytes()); }, impl_->mat);
+}
+
+}  // namespace cws
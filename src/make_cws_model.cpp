@@ -0,0 +1,51 @@
+#include <chrono>
+
+#include "cmdline.h"
+#include "sketcher.hpp"
+
+int main(int argc, char** argv) {
+    ios::sync_with_stdio(false);
+    cout << "num threads: " << omp_get_max_threads() << endl;
+
+    cmdline::parser p;
+    p.add<string>("output_fn", 'o', "output file name of the model of random matrix data", true);
+    p.add<size_t>("dat_dim", 'd', "dimension of the input data", true);
+    p.add<size_t>("cws_dim", 'D', "dimension of the output CWS-sketches", false, 64);
+    p.add<bool>("generalized", 'g', "Does the input data need to be generalized?", false, false);
+    p.add<size_t>("seed", 's', "seed for random matrix data", false, 114514);
+    p.add<string>("method", 'a', "sampling method (icws/pcws/i2cws)", false, "icws");
+    p.add<bool>("feature_major", 'F', "Store random matrix data in feature-major order? (faster for sparse data)",
+                false, false);
+    p.parse_check(argc, argv);
+
+    auto output_fn = p.get<string>("output_fn");
+    auto dat_dim = p.get<size_t>("dat_dim");
+    auto cws_dim = p.get<size_t>("cws_dim");
+    auto generalized = p.get<bool>("generalized");
+    auto seed = p.get<size_t>("seed");
+    auto feature_major = p.get<bool>("feature_major");
+    auto method = cws::parse_method(p.get<string>("method"));
+
+    if (generalized) {
+        dat_dim *= 2;
+    }
+
+    cout << "1) Generate random matrix data..." << endl;
+
+    auto start_tp = chrono::system_clock::now();
+    const auto type = feature_major ? cws::matrix_type::feature_major : cws::matrix_type::sample_major;
+    cws::sketcher sketcher(dat_dim, cws_dim, seed, type, method);
+
+    auto dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
+    cout << "Elapsed time: " << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s" << endl;
+
+    cout << "2) Save the model file..." << endl;
+
+    output_fn += ".model";
+    sketcher.save(output_fn);
+
+    auto MiB = sketcher.memory_in_bytes() / (1024.0 * 1024.0);
+    cout << "Output " << output_fn << " of " << MiB << " MiB in " << (feature_major ? "feature" : "sample")
+         << "-major layout for " << cws::get_method_name(method) << endl;
+    return 0;
+}
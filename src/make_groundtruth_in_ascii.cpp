@@ -1,3 +1,4 @@
+#include "ascii_parser.hpp"
 #include "cmdline.h"
 #include "misc.hpp"
 
@@ -11,11 +12,12 @@ int run(const cmdline::parser& p) {
     auto begin_id = p.get<uint32_t>("begin_id");
     auto topk = p.get<uint32_t>("topk");
     auto progress = p.get<size_t>("progress");
+    auto parallel_parse = p.get<bool>("parallel_parse");
 
-    const auto base_vecs = load_vecs<Flags>(base_fn, begin_id);
+    const auto base_vecs = load_flat_vecs<Flags>(base_fn, begin_id, parallel_parse);
     size_t N = base_vecs.size();
 
-    const auto query_vecs = load_vecs<Flags>(query_fn, begin_id);
+    const auto query_vecs = load_flat_vecs<Flags>(query_fn, begin_id, parallel_parse);
     size_t M = query_vecs.size();
 
     struct id_sim_t {
@@ -44,11 +46,11 @@ int run(const cmdline::parser& p) {
             cout << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s" << endl;
         }
 
-        const auto& query = query_vecs[j];
+        const auto query = query_vecs[j];
 
 #pragma omp parallel for
         for (size_t i = 0; i < N; ++i) {
-            const auto& base = base_vecs[i];
+            const auto base = base_vecs[i];
             id_sims[i].id = uint32_t(i);
             id_sims[i].sim = calc_minmax_sim<Flags>(base, query);
         }
@@ -103,6 +105,7 @@ int main(int argc, char** argv) {
     p.add<bool>("labeled", 'l', "Does each input vector have a label at the head?", false, false);
     p.add<uint32_t>("topk", 'k', "k-nearest neighbors", false, 100);
     p.add<size_t>("progress", 'p', "step of printing progress", false, 100);
+    p.add<bool>("parallel_parse", 'P', "Parse the input files in parallel via mmap?", false, false);
     p.parse_check(argc, argv);
 
     auto weighted = p.get<bool>("weighted");
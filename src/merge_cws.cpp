@@ -0,0 +1,132 @@
+#include <chrono>
+
+#include "cmdline.h"
+#include "misc.hpp"
+#include "sketch_format.hpp"
+#include "sketcher.hpp"
+
+constexpr size_t BUFFER_VECS = 100'000;
+
+// Reader of partial sketches output with option -e, i.e., sampled feature IDs in ivecs format and
+// their hash values in fvecs format
+class part_reader {
+  public:
+    explicit part_reader(const string& input_fn)
+        : ids_fn_(input_fn + ".ivecs"), as_fn_(input_fn + ".fvecs"), ids_in_(make_ifstream(ids_fn_)),
+          as_in_(make_ifstream(as_fn_)) {}
+
+    // Reads up to num_vecs sketches into the buffers, returning the number of sketches read
+    size_t read(size_t num_vecs, size_t cws_dim, uint32_t* min_ids, float* min_as) {
+        for (size_t id = 0; id < num_vecs; ++id) {
+            const auto ids_dim = read_value<uint32_t>(ids_in_);
+            const auto as_dim = read_value<uint32_t>(as_in_);
+            if (ids_in_.eof() or as_in_.eof()) {
+                if (!ids_in_.eof() or !as_in_.eof()) {
+                    cerr << "error: different numbers of vecs in " << ids_fn_ << " and " << as_fn_ << endl;
+                    exit(1);
+                }
+                return id;
+            }
+            if (ids_dim != cws_dim or as_dim != cws_dim) {
+                cerr << "error: cws_dim of " << ids_fn_ << " differs from " << cws_dim << endl;
+                exit(1);
+            }
+            read_vec(ids_in_, &min_ids[id * cws_dim], cws_dim);
+            read_vec(as_in_, &min_as[id * cws_dim], cws_dim);
+        }
+        return num_vecs;
+    }
+
+    // Peeks the dimension of the first sketch
+    size_t cws_dim() {
+        const auto dim = read_value<uint32_t>(ids_in_);
+        ids_in_.seekg(0);
+        return ids_in_.eof() ? 0 : dim;
+    }
+
+    const string& filename() const {
+        return ids_fn_;
+    }
+
+  private:
+    string ids_fn_;
+    string as_fn_;
+    ifstream ids_in_;
+    ifstream as_in_;
+};
+
+int main(int argc, char** argv) {
+    ios::sync_with_stdio(false);
+
+    cmdline::parser p;
+    p.add<string>("input_fns", 'i',
+                  "comma-separated input file names of partial CWS-sketches output with option -e, "
+                  "in the order of the features",
+                  true);
+    p.add<string>("output_fn", 'o', "output file name of the merged CWS-sketches (in ivecs and fvecs format)", true);
+    p.parse_check(argc, argv);
+
+    auto input_fns = p.get<string>("input_fns");
+    auto output_fn = p.get<string>("output_fn");
+
+    vector<part_reader> parts;
+    istringstream input_iss(input_fns);
+    for (string input_fn; getline(input_iss, input_fn, ',');) {
+        parts.emplace_back(input_fn);
+    }
+    if (parts.empty()) {
+        cerr << "error: no input files" << endl;
+        return 1;
+    }
+
+    const size_t cws_dim = parts[0].cws_dim();
+    if (cws_dim == 0) {
+        cerr << "error: no sketches in " << parts[0].filename() << endl;
+        return 1;
+    }
+    cout << "Merge " << parts.size() << " partial CWS-sketches of " << cws_dim << " dimensions" << endl;
+
+    sketch_format::sketch_writer<uint32_t> ids_out(output_fn, cws_dim, 0, 0, 0);
+    sketch_format::hash_writer as_out(output_fn, cws_dim);
+
+    vector<uint32_t> min_ids(BUFFER_VECS * cws_dim);
+    vector<float> min_as(BUFFER_VECS * cws_dim);
+    vector<uint32_t> part_ids(BUFFER_VECS * cws_dim);
+    vector<float> part_as(BUFFER_VECS * cws_dim);
+
+    size_t processed = 0;
+    auto start_tp = chrono::system_clock::now();
+
+    while (true) {
+        fill(min_ids.begin(), min_ids.end(), 0);
+        fill(min_as.begin(), min_as.end(), numeric_limits<float>::max());
+
+        size_t num_vecs = 0;
+        for (size_t k = 0; k < parts.size(); ++k) {
+            const size_t part_vecs = parts[k].read(BUFFER_VECS, cws_dim, part_ids.data(), part_as.data());
+            if (k != 0 and part_vecs != num_vecs) {
+                cerr << "error: the number of vecs in " << parts[k].filename() << " differs from that in "
+                     << parts[0].filename() << endl;
+                return 1;
+            }
+            num_vecs = part_vecs;
+            cws::merge_sketches(num_vecs, cws_dim, part_ids.data(), part_as.data(), min_ids.data(), min_as.data());
+        }
+        if (num_vecs == 0) {
+            break;
+        }
+
+        ids_out.write(reinterpret_cast<const uint8_t*>(min_ids.data()), num_vecs);
+        as_out.write(min_as.data(), num_vecs);
+
+        processed += num_vecs;
+        auto dur_cnt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - start_tp).count();
+        cout << processed << " vecs merged in ";
+        cout << dur_cnt / 3600 << "h" << dur_cnt / 60 % 60 << "m" << dur_cnt % 60 << "s" << endl;
+    }
+
+    ids_out.finish();
+    as_out.finish();
+    cout << "Output " << ids_out.filename() << " and " << as_out.filename() << endl;
+    return 0;
+}
@@ -1,15 +1,24 @@
 #pragma once
 
+#include <fcntl.h>
 #include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <random>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "decompress.hpp"
+#include "splitmix.hpp"
+
 using namespace std;
 
 template <typename T>
@@ -49,15 +58,173 @@ inline ofstream make_ofstream(const string& filepath) {
     return ofs;
 }
 
+// File name "-" stands for the standard input or output, through which data flow via pipes
+inline bool is_stdio(const string& filepath) {
+    return filepath == "-";
+}
+
+// Whether the input can be sought or mapped, unlike the standard input and compressed files
+inline bool is_seekable(const string& filepath) {
+    return !is_stdio(filepath) and get_compression(filepath) == compression_type::none;
+}
+
+// Buffer of the standard output reserved for data, even after cout is redirected by redirect_logs()
+inline streambuf* get_stdout_buf() {
+    static streambuf* const buf = cout.rdbuf();
+    return buf;
+}
+
+// Redirects logs printed to cout to cerr, so that the standard output carries only data
+inline void redirect_logs() {
+    get_stdout_buf();
+    cout.rdbuf(cerr.rdbuf());
+}
+
+// Files compressed with gzip/bzip2/zstd (by the extension) are decompressed transparently
+inline unique_ptr<istream> make_istream(const string& filepath) {
+    if (is_stdio(filepath)) {
+        return make_unique<istream>(cin.rdbuf());
+    }
+    if (const compression_type type = get_compression(filepath); type != compression_type::none) {
+        return make_unique<decompress_istream>(filepath, type);
+    }
+    return make_unique<ifstream>(make_ifstream(filepath));
+}
+inline unique_ptr<ostream> make_ostream(const string& filepath) {
+    if (is_stdio(filepath)) {
+        return make_unique<ostream>(get_stdout_buf());
+    }
+    return make_unique<ofstream>(make_ofstream(filepath));
+}
+
+// Read-only memory mapping of a whole file
+class mmap_file {
+  public:
+    mmap_file() = default;
+
+    explicit mmap_file(const string& filepath) {
+        int fd = open(filepath.c_str(), O_RDONLY);
+        if (fd == -1) {
+            cerr << "open error: " << filepath << endl;
+            exit(1);
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            cerr << "stat error: " << filepath << endl;
+            exit(1);
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ != 0) {
+            void* addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED) {
+                cerr << "mmap error: " << filepath << endl;
+                exit(1);
+            }
+            data_ = static_cast<const char*>(addr);
+        }
+        close(fd);
+    }
+
+    ~mmap_file() {
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    mmap_file(const mmap_file&) = delete;
+    mmap_file& operator=(const mmap_file&) = delete;
+
+    mmap_file(mmap_file&& other) noexcept : data_(other.data_), size_(other.size_) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    mmap_file& operator=(mmap_file&& other) noexcept {
+        swap(data_, other.data_);
+        swap(size_, other.size_);
+        return *this;
+    }
+
+    const char* data() const {
+        return data_;
+    }
+    size_t size() const {
+        return size_;
+    }
+
+    void advise_sequential() const {
+        if (data_ != nullptr) {
+            madvise(const_cast<char*>(data_), size_, MADV_SEQUENTIAL);
+        }
+    }
+
+  private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
 using gamma_t = gamma_distribution<float>;
 using uniform_t = uniform_real_distribution<float>;
 
+// Number of random values generated from each derived seed in generate_random_matrix
+constexpr size_t RANDOM_BLOCK_SIZE = size_t(1) << 16;
+
+// Calls fn(engine, beg, end) in parallel for each block [beg, end) of RANDOM_BLOCK_SIZE positions in [0, size),
+// where the engine is seeded for the block via splitmix64, so the result is independent of the number of threads.
+template <class Fn>
+void for_each_random_block(size_t size, size_t seed, Fn&& fn) {
+    const size_t num_blocks = (size + RANDOM_BLOCK_SIZE - 1) / RANDOM_BLOCK_SIZE;
+
+#pragma omp parallel for schedule(static)
+    for (size_t blk = 0; blk < num_blocks; ++blk) {
+        // The blk-th output of splitmix64(seed)
+        mt19937_64 engine(splitmix64::mix(seed + (blk + 1) * uint64_t(0x9E3779B97F4A7C15)));
+        fn(engine, blk * RANDOM_BLOCK_SIZE, min(size, (blk + 1) * RANDOM_BLOCK_SIZE));
+    }
+}
+
+// Fills out[0..size) with random values of the distribution in parallel blocks
 template <typename Dist>
-void generate_random_matrix(Dist&& dist, vector<float>& out, size_t seed) {
-    mt19937_64 engine(seed);
-    for (size_t i = 0; i < out.size(); ++i) {
-        out[i] = static_cast<float>(dist(engine));
+void generate_random_matrix(const Dist& dist, float* out, size_t size, size_t seed) {
+    for_each_random_block(size, seed, [&](mt19937_64& engine, size_t beg, size_t end) {
+        Dist blk_dist(dist.param());
+        for (size_t i = beg; i < end; ++i) {
+            out[i] = static_cast<float>(blk_dist(engine));
+        }
+    });
+}
+
+// Portion index/count of an input file processed by one of count processes, e.g., on different nodes
+struct shard_t {
+    size_t index = 0;
+    size_t count = 1;
+
+    // Range [begin(size), end(size)) of size units (bytes or records) assigned to the shard
+    size_t begin(size_t size) const {
+        return size / count * index + size % count * index / count;
+    }
+    size_t end(size_t size) const {
+        return size / count * (index + 1) + size % count * (index + 1) / count;
     }
+};
+
+// Parses a shard in the form of "i/n" (0 <= i < n), or exits if it is invalid
+inline shard_t parse_shard(const string& str) {
+    shard_t shard;
+    const auto pos = str.find('/');
+    try {
+        if (pos == string::npos) {
+            throw invalid_argument(str);
+        }
+        shard.index = stoul(str.substr(0, pos));
+        shard.count = stoul(str.substr(pos + 1));
+    } catch (const logic_error&) {
+        shard.count = 0;
+    }
+    if (shard.count == 0 or shard.count <= shard.index) {
+        cerr << "error: invalid shard " << str << " (must be i/n for 0 <= i < n)" << endl;
+        exit(1);
+    }
+    return shard;
 }
 
 inline string get_ext(const string& fn) {
@@ -71,20 +238,37 @@ class data_loader {
   public:
     data_loader() = default;
 
-    // if Generalized = trie, dim needs to be set twice
-    data_loader(const string& fn, uint32_t dim) : ifs_(fn), vec_(dim) {
+    // if Generalized = trie, dim needs to be set twice.
+    // Only the records of the shard are loaded, seeking to the first one of them.
+    data_loader(const string& fn, uint32_t dim, shard_t shard = {}) : in_(make_istream(fn)), vec_(dim) {
         if constexpr (Generalized) {
             static_assert(is_same_v<OutType, float>);
         }
-        if (!ifs_) {
-            cerr << "open error: " << fn << '\n';
-            exit(1);
+        if (shard.count > 1) {
+            if (!is_seekable(fn)) {
+                cerr << "error: the standard input or compressed files cannot be sharded" << endl;
+                exit(1);
+            }
+            // The records are of the same size as the first one
+            const auto rec_dim = read_value<uint32_t>(*in_);
+            in_->seekg(0, ios::end);
+            const size_t file_bytes = *in_ ? static_cast<size_t>(in_->tellg()) : 0;
+            const size_t rec_bytes = sizeof(uint32_t) + rec_dim * sizeof(InType);
+            const size_t num_recs = file_bytes / rec_bytes;
+            in_->clear();
+            in_->seekg(shard.begin(num_recs) * rec_bytes);
+            remaining_ = shard.end(num_recs) - shard.begin(num_recs);
         }
     }
 
     const OutType* next() {
-        auto dim = read_value<uint32_t>(ifs_);
-        if (ifs_.eof()) {
+        if (remaining_ == 0) {
+            return nullptr;
+        }
+        remaining_ -= 1;
+
+        auto dim = read_value<uint32_t>(*in_);
+        if (in_->eof()) {
             return nullptr;
         }
 
@@ -93,7 +277,7 @@ class data_loader {
                 vec_.resize(dim * 2);
             }
             for (uint32_t j = 0; j < dim; ++j) {
-                auto v = static_cast<OutType>(read_value<InType>(ifs_));
+                auto v = static_cast<OutType>(read_value<InType>(*in_));
                 if (v >= 0.0) {
                     vec_[j * 2] = v;
                     vec_[j * 2 + 1] = 0.0;
@@ -107,7 +291,7 @@ class data_loader {
                 vec_.resize(dim);
             }
             for (uint32_t j = 0; j < dim; ++j) {
-                vec_[j] = static_cast<OutType>(read_value<InType>(ifs_));
+                vec_[j] = static_cast<OutType>(read_value<InType>(*in_));
             }
         }
 
@@ -115,8 +299,9 @@ class data_loader {
     }
 
   private:
-    ifstream ifs_;
+    unique_ptr<istream> in_;
     vector<OutType> vec_;
+    size_t remaining_ = numeric_limits<size_t>::max();
 };
 
 template <class InType, class OutType = float, bool Generalized = false>
@@ -228,19 +413,36 @@ class data_loader {
   public:
     data_loader() = default;
 
-    data_loader(const string& fn, uint32_t begin_id) : ifs_(fn), begin_id_(begin_id) {
-        if (!ifs_) {
-            cerr << "open error: " << fn << '\n';
-            exit(1);
+    // Only the lines beginning in the byte range of the shard are loaded, seeking to the first one of them
+    data_loader(const string& fn, uint32_t begin_id, shard_t shard = {})
+        : in_(make_istream(fn)), begin_id_(begin_id) {
+        if (shard.count > 1) {
+            if (!is_seekable(fn)) {
+                cerr << "error: the standard input or compressed files cannot be sharded" << endl;
+                exit(1);
+            }
+            in_->seekg(0, ios::end);
+            const size_t file_bytes = static_cast<size_t>(in_->tellg());
+            pos_ = shard.begin(file_bytes);
+            end_ = shard.end(file_bytes);
+            if (pos_ == 0) {
+                in_->seekg(0);
+            } else {
+                // Skip the line including the byte before the range
+                in_->seekg(pos_ - 1);
+                in_->ignore(numeric_limits<streamsize>::max(), '\n');
+                pos_ = *in_ ? static_cast<size_t>(in_->tellg()) : file_bytes;
+            }
         }
     }
 
     bool next() {
         vec_.clear();
 
-        if (!getline(ifs_, line_)) {
+        if (pos_ >= end_ or !getline(*in_, line_)) {
             return false;
         }
+        pos_ += line_.size() + 1;
 
         istringstream iss(line_);
         if constexpr (is_labeled<Flags>()) {
@@ -287,10 +489,12 @@ class data_loader {
     }
 
   private:
-    ifstream ifs_;
+    unique_ptr<istream> in_;
     vector<elem_type<Flags>> vec_;
     string line_;
     uint32_t begin_id_ = 0;
+    size_t pos_ = 0;
+    size_t end_ = numeric_limits<size_t>::max();
 };
 
 template <int Flags>
@@ -304,8 +508,8 @@ inline vector<vector<elem_type<Flags>>> load_vecs(const string& fn, uint32_t beg
     return vecs;
 }
 
-template <int Flags>
-inline float calc_minmax_sim(const vector<elem_type<Flags>>& x, const vector<elem_type<Flags>>& y) {
+template <int Flags, class DataVec>
+inline float calc_minmax_sim(const DataVec& x, const DataVec& y) {
     float min_sum = 0.0;
     float max_sum = 0.0;
     size_t i = 0, j = 0;
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+#include "misc.hpp"
+
+/****
+ *  Three-stage pipeline of load, sample and write over batches of vectors
+ */
+
+template <class T>
+class blocking_queue {
+  public:
+    void push(T val) {
+        {
+            lock_guard<mutex> lock(mtx_);
+            que_.push(move(val));
+        }
+        cv_.notify_one();
+    }
+
+    T pop() {
+        unique_lock<mutex> lock(mtx_);
+        cv_.wait(lock, [this] { return !que_.empty(); });
+        T val = move(que_.front());
+        que_.pop();
+        return val;
+    }
+
+  private:
+    queue<T> que_;
+    mutex mtx_;
+    condition_variable cv_;
+};
+
+// Busy time of each stage in seconds
+struct pipeline_stats {
+    double load_sec = 0.0;
+    double sample_sec = 0.0;
+    double write_sec = 0.0;
+
+    const char* bottleneck() const {
+        if (load_sec >= sample_sec and load_sec >= write_sec) {
+            return "load";
+        }
+        return sample_sec >= write_sec ? "sample" : "write";
+    }
+
+    void print(ostream& os) const {
+        os << "Busy time of stages: load " << load_sec << "s, sample " << sample_sec << "s, write " << write_sec
+           << "s --> the bottleneck is " << bottleneck() << endl;
+    }
+};
+
+inline double get_elapsed_sec(chrono::system_clock::time_point start_tp) {
+    return chrono::duration<double>(chrono::system_clock::now() - start_tp).count();
+}
+
+// Processes batches until load returns false, where load fills a batch, sample processes it
+// on the calling thread, and write outputs it in the loaded order.
+// If more than one batch is given, load and write run on their own threads,
+// overlapping with sample of the other batches.
+template <class Batch, class Load, class Sample, class Write>
+pipeline_stats run_pipeline(vector<Batch>& batches, Load&& load, Sample&& sample, Write&& write) {
+    pipeline_stats stats;
+
+    if (batches.size() == 1) {
+        Batch& batch = batches[0];
+        while (true) {
+            auto tp = chrono::system_clock::now();
+            bool loaded = load(batch);
+            stats.load_sec += get_elapsed_sec(tp);
+            if (!loaded) {
+                break;
+            }
+
+            tp = chrono::system_clock::now();
+            sample(batch);
+            stats.sample_sec += get_elapsed_sec(tp);
+
+            tp = chrono::system_clock::now();
+            write(batch);
+            stats.write_sec += get_elapsed_sec(tp);
+        }
+        return stats;
+    }
+
+    // nullptr notifies the end of input
+    blocking_queue<Batch*> free_que, loaded_que, sampled_que;
+    for (Batch& batch : batches) {
+        free_que.push(&batch);
+    }
+
+    thread reader([&] {
+        while (true) {
+            Batch* batch = free_que.pop();
+            auto tp = chrono::system_clock::now();
+            bool loaded = load(*batch);
+            stats.load_sec += get_elapsed_sec(tp);
+            if (!loaded) {
+                loaded_que.push(nullptr);
+                break;
+            }
+            loaded_que.push(batch);
+        }
+    });
+
+    thread writer([&] {
+        while (true) {
+            Batch* batch = sampled_que.pop();
+            if (batch == nullptr) {
+                break;
+            }
+            auto tp = chrono::system_clock::now();
+            write(*batch);
+            stats.write_sec += get_elapsed_sec(tp);
+            free_que.push(batch);
+        }
+    });
+
+    while (true) {
+        Batch* batch = loaded_que.pop();
+        if (batch == nullptr) {
+            sampled_que.push(nullptr);
+            break;
+        }
+        auto tp = chrono::system_clock::now();
+        sample(*batch);
+        stats.sample_sec += get_elapsed_sec(tp);
+        sampled_que.push(batch);
+    }
+
+    reader.join();
+    writer.join();
+    return stats;
+}
@@ -1,9 +1,13 @@
+#include "bit_planes.hpp"
 #include "cmdline.h"
+#include "hamdist_simd.hpp"
 #include "misc.hpp"
+#include "sketch_format.hpp"
 
 using namespace texmex_format;
 
-uint32_t get_hamdist(const uint8_t* v1, const uint8_t* v2, uint32_t dim) {
+template <class SampleType>
+uint32_t get_hamdist(const SampleType* v1, const SampleType* v2, uint32_t dim) {
     uint32_t errs = 0;
     for (uint32_t i = 0; i < dim; ++i) {
         if (v1[i] != v2[i]) {
@@ -13,87 +17,517 @@ uint32_t get_hamdist(const uint8_t* v1, const uint8_t* v2, uint32_t dim) {
     return errs;
 }
 
+struct id_errs_t {
+    uint32_t id;
+    uint32_t errs;
+};
+
+// Ranks by errors, breaking ties by IDs
+inline bool operator<(const id_errs_t& a, const id_errs_t& b) {
+    if (a.errs != b.errs) {
+        return a.errs < b.errs;
+    }
+    return a.id < b.id;
+}
+
+// Queries searched at once, whose results are buffered before being output in order,
+// up to the buffer of QUERY_BLOCK_BYTES (e.g., fewer queries for K close to N)
+constexpr size_t QUERY_BLOCK = 4096;
+constexpr size_t QUERY_BLOCK_BYTES = size_t(64) << 20;
+
+// Ratio of N to K up to which the top-k is selected by counting rather than by a heap
+constexpr size_t COUNTING_MIN_RATIO = 256;
+
+// Interleaved histograms, so that runs of equal errors do not stall on increments of the same counter
+constexpr size_t NUM_HISTS = 4;
+
+// Bits up to which the codes are bit-sliced by default, scanning fewer bytes than one per sample
+constexpr uint32_t MAX_AUTO_PLANES = 4;
+
+// Codes read at once to be bit-sliced
+constexpr size_t SLICE_BLOCK = size_t(1) << 16;
+
+// Fraction of the caches for tiles of base codes (of L2) and of queries with their heaps (of the share of L3)
+constexpr size_t TILE_CACHE_RATIO = 2;
+
+// Cache sizes assumed if unknown to the system
+constexpr size_t DEFAULT_L2_BYTES = size_t(1) << 20;
+constexpr size_t DEFAULT_L3_BYTES = size_t(8) << 20;
+
+// Size of the L2 (or L3) cache in bytes
+inline size_t get_cache_bytes(int level) {
+#if defined(_SC_LEVEL2_CACHE_SIZE) && defined(_SC_LEVEL3_CACHE_SIZE)
+    const long bytes = sysconf(level == 2 ? _SC_LEVEL2_CACHE_SIZE : _SC_LEVEL3_CACHE_SIZE);
+    if (bytes > 0) {
+        return static_cast<size_t>(bytes);
+    }
+#endif
+    return level == 2 ? DEFAULT_L2_BYTES : DEFAULT_L3_BYTES;
+}
+
+// Numbers of base codes and queries in a tile of the scan, where each thread compares a tile of queries
+// with a tile of base codes resident in its L2 cache, reading the base from memory once per tile of queries
+struct tile_sizes {
+    size_t codes = 0;
+    size_t queries = 0;
+};
+
+inline tile_sizes get_tile_sizes(size_t code_bytes, size_t K) {
+    tile_sizes tiles;
+    tiles.codes = max<size_t>(1, get_cache_bytes(2) / TILE_CACHE_RATIO / code_bytes);
+    const size_t l3_share = get_cache_bytes(3) / TILE_CACHE_RATIO / omp_get_max_threads();
+    tiles.queries = max<size_t>(1, l3_share / (code_bytes + K * sizeof(id_errs_t)));
+    return tiles;
+}
+
+// Pushes the scores of base IDs [beg, end) into the max-heap of the size best scores in ranked, up to K
+template <class GetErrs>
+void push_to_heap(size_t beg, size_t end, size_t K, GetErrs&& get_errs, id_errs_t* ranked, size_t& size) {
+    for (; beg < end and size < K; ++beg) {
+        ranked[size++] = {uint32_t(beg), get_errs(beg)};
+        push_heap(ranked, ranked + size);
+    }
+    for (size_t i = beg; i < end and K != 0; ++i) {
+        const id_errs_t score = {uint32_t(i), get_errs(i)};
+        if (score < ranked[0]) {
+            pop_heap(ranked, ranked + K);
+            ranked[K - 1] = score;
+            push_heap(ranked, ranked + K);
+        }
+    }
+}
+
+// Selects the K best scores of base IDs [0, N) into ranked in ascending order, keeping a max-heap of them
+template <class GetErrs>
+void select_by_heap(size_t N, size_t K, GetErrs&& get_errs, id_errs_t* ranked) {
+    size_t size = 0;
+    push_to_heap(0, N, K, get_errs, ranked, size);
+    sort_heap(ranked, ranked + size);
+}
+
+// Selects the K best scores in the same manner by counting errors of at most max_errs in a histogram,
+// which finds the cutoff errors of the top-k in O(N + max_errs) time. The scores below the cutoff
+// (and the first ones at the cutoff) are placed by the counts in ascending order of errors and IDs.
+// The errors are buffered in ErrType, the narrowest type covering max_errs, to scan them again.
+template <class ErrType, class GetErrs>
+void select_by_counting(size_t N, size_t K, uint32_t max_errs, GetErrs&& get_errs, id_errs_t* ranked) {
+    thread_local vector<ErrType> errs;
+    thread_local vector<uint32_t> hists;
+    errs.resize(N);
+    hists.assign(NUM_HISTS * (max_errs + 1), 0);
+
+    uint32_t* hist = hists.data();
+    const size_t N_hists = N / NUM_HISTS * NUM_HISTS;
+    for (size_t i = 0; i < N_hists; i += NUM_HISTS) {
+        for (size_t h = 0; h < NUM_HISTS; ++h) {
+            const uint32_t e = get_errs(i + h);
+            errs[i + h] = static_cast<ErrType>(e);
+            hist[h * (max_errs + 1) + e] += 1;
+        }
+    }
+    for (size_t i = N_hists; i < N; ++i) {
+        const uint32_t e = get_errs(i);
+        errs[i] = static_cast<ErrType>(e);
+        hist[e] += 1;
+    }
+    for (size_t h = 1; h < NUM_HISTS; ++h) {
+        for (uint32_t e = 0; e <= max_errs; ++e) {
+            hist[e] += hist[h * (max_errs + 1) + e];
+        }
+    }
+
+    // Turn the counts into the positions of the errors in ranked, up to the cutoff
+    uint32_t cutoff = 0;
+    size_t pos = 0;
+    for (; cutoff <= max_errs; ++cutoff) {
+        const size_t count = hist[cutoff];
+        hist[cutoff] = static_cast<uint32_t>(pos);
+        pos += count;
+        if (pos >= K) {
+            break;
+        }
+    }
+
+    // Most of the scores are above the cutoff, which are skipped by chunks in a vectorized test
+    constexpr size_t CHUNK = 64;
+    const ErrType cutoff_e = static_cast<ErrType>(min<uint32_t>(cutoff, numeric_limits<ErrType>::max()));
+    for (size_t beg = 0; beg < N; beg += CHUNK) {
+        const size_t end = min(N, beg + CHUNK);
+        bool hit = false;
+        for (size_t i = beg; i < end; ++i) {
+            hit |= errs[i] <= cutoff_e;
+        }
+        if (!hit) {
+            continue;
+        }
+        for (size_t i = beg; i < end; ++i) {
+            const uint32_t e = errs[i];
+            if (e <= cutoff and hist[e] < K) {
+                ranked[hist[e]++] = {uint32_t(i), e};
+            }
+        }
+    }
+}
+
+// Outputs the top-k base IDs for each query in ascending order of get_errs(base_id, query_id) of at most max_errs.
+// Queries are searched in parallel, each selecting the top-k by a heap or by counting errors without sorting.
+// With the heap, the base of code_bytes per code is scanned in tiles shared by tiles of queries if tiled.
+template <class GetErrs>
+void search_topk(size_t N, size_t M, uint32_t topk, uint32_t max_errs, size_t code_bytes, bool tiled,
+                 GetErrs&& get_errs, ostream& os) {
+    const size_t K = min<size_t>(topk, N);
+    const size_t block = min(QUERY_BLOCK, max<size_t>(1, QUERY_BLOCK_BYTES / max<size_t>(1, K * sizeof(id_errs_t))));
+    vector<id_errs_t> results(min(M, block) * K);
+
+    // The heap rarely changes after the first scores if K is much smaller than N, whereas counting costs
+    // a constant time per score, which pays off for large K (e.g., K >= 1% of N in our experiments)
+    const bool counting = max_errs < N and K * COUNTING_MIN_RATIO >= N;
+
+    tile_sizes tiles;
+    if (tiled and !counting) {
+        tiles = get_tile_sizes(code_bytes, K);
+        cout << "Tiles: " << tiles.codes << " base codes x " << tiles.queries << " queries" << endl;
+    }
+
+    os << M << '\n' << K << '\n';
+
+    auto start_tp = chrono::system_clock::now();
+
+    for (size_t beg = 0; beg < M; beg += block) {
+        const size_t end = min(M, beg + block);
+
+        if (tiles.codes != 0) {
+            // Split the queries into at least as many tiles as threads
+            const size_t num_threads = omp_get_max_threads();
+            const size_t tile_queries = min(tiles.queries, (end - beg + num_threads - 1) / num_threads);
+            const size_t num_tiles = (end - beg + tile_queries - 1) / tile_queries;
+
+#pragma omp parallel for schedule(dynamic)
+            for (size_t t = 0; t < num_tiles; ++t) {
+                const size_t tile_beg = beg + t * tile_queries;
+                const size_t tile_end = min(end, tile_beg + tile_queries);
+                thread_local vector<size_t> sizes;
+                sizes.assign(tile_end - tile_beg, 0);
+
+                for (size_t i_beg = 0; i_beg < N; i_beg += tiles.codes) {
+                    const size_t i_end = min(N, i_beg + tiles.codes);
+                    for (size_t j = tile_beg; j < tile_end; ++j) {
+                        push_to_heap(
+                            i_beg, i_end, K, [&](size_t i) { return get_errs(i, j); }, results.data() + (j - beg) * K,
+                            sizes[j - tile_beg]);
+                    }
+                }
+                for (size_t j = tile_beg; j < tile_end; ++j) {
+                    sort_heap(results.data() + (j - beg) * K, results.data() + (j - beg) * K + sizes[j - tile_beg]);
+                }
+            }
+        } else {
+#pragma omp parallel for schedule(dynamic)
+            for (size_t j = beg; j < end; ++j) {
+                id_errs_t* ranked = results.data() + (j - beg) * K;
+                auto get_query_errs = [&](size_t i) { return get_errs(i, j); };
+                if (counting and max_errs <= numeric_limits<uint8_t>::max()) {
+                    select_by_counting<uint8_t>(N, K, max_errs, get_query_errs, ranked);
+                } else if (counting and max_errs <= numeric_limits<uint16_t>::max()) {
+                    select_by_counting<uint16_t>(N, K, max_errs, get_query_errs, ranked);
+                } else if (counting) {
+                    select_by_counting<uint32_t>(N, K, max_errs, get_query_errs, ranked);
+                } else {
+                    select_by_heap(N, K, get_query_errs, ranked);
+                }
+            }
+        }
+
+        for (size_t j = beg; j < end; ++j) {
+            const id_errs_t* ranked = results.data() + (j - beg) * K;
+            for (size_t i = 0; i < K; ++i) {
+                os << ranked[i].id << ':' << ranked[i].errs << ',';
+            }
+            os << '\n';
+        }
+    }
+
+    auto dur_sec = chrono::duration<double>(chrono::system_clock::now() - start_tp).count();
+    cout << "Searched " << M << " queries in " << dur_sec << "s (" << M / max(dur_sec, 1e-9) << " QPS)" << endl;
+}
+
+// Loads the codes into their bit-planes block by block, so that the codes are never held at once
+template <class SampleType>
+vector<uint64_t> load_sliced_codes(const string& fn, uint32_t dim, uint32_t bits) {
+    const size_t record_words = bit_planes::get_record_words(dim, bits);
+    data_loader<SampleType, SampleType> loader(fn, dim);
+
+    vector<SampleType> block;
+    vector<uint64_t> records;
+    for (bool more = true; more;) {
+        block.clear();
+        while (block.size() < SLICE_BLOCK * dim) {
+            const SampleType* vec = loader.next();
+            if (vec == nullptr) {
+                more = false;
+                break;
+            }
+            block.insert(block.end(), vec, vec + dim);
+        }
+        const size_t num_vecs = block.size() / dim;
+        const size_t offset = records.size();
+        records.resize(offset + num_vecs * record_words);
+        bit_planes::slice_all(block.data(), num_vecs, dim, bits, records.data() + offset);
+    }
+    records.shrink_to_fit();
+    return records;
+}
+
+// Searches the codes bit-sliced into bits planes, taking bits / (8 * sizeof(SampleType)) of their memory
+template <class SampleType>
+void search_sliced(const string& base_fn, const string& query_fn, uint32_t bits, uint32_t dim, uint32_t topk,
+                   bool tiled, ostream& os) {
+    const size_t record_words = bit_planes::get_record_words(dim, bits);
+    const vector<uint64_t> base_planes = load_sliced_codes<SampleType>(base_fn, dim, bits);
+    const vector<uint64_t> query_planes = load_sliced_codes<SampleType>(query_fn, dim, bits);
+    const size_t N = base_planes.size() / record_words;
+    const size_t M = query_planes.size() / record_words;
+
+    cout << "Bit-planes: " << bits << " x " << bit_planes::get_words_per_plane(dim) << " words per code" << endl;
+    bit_planes::dispatch(bits, dim, [&](auto kernel) {
+        search_topk(
+            N, M, topk, dim, record_words * sizeof(uint64_t), tiled,
+            [&](size_t i, size_t j) { return kernel(&base_planes[i * record_words], &query_planes[j * record_words]); },
+            os);
+    });
+}
+
+template <class SampleType>
+void search_vecs(const string& base_fn, const string& query_fn, uint32_t bits, uint32_t dim, uint32_t topk,
+                 simd_level level, bool sliced, bool tiled, ostream& os) {
+    if (sliced) {
+        search_sliced<SampleType>(base_fn, query_fn, bits, dim, topk, tiled, os);
+        return;
+    }
+
+    vector<SampleType> base_codes = load_vecs<SampleType, SampleType>(base_fn, dim);
+    size_t N = base_codes.size() / dim;
+
+    vector<SampleType> query_codes = load_vecs<SampleType, SampleType>(query_fn, dim);
+    size_t M = query_codes.size() / dim;
+
+    if (bits < sizeof(SampleType) * 8) {
+        SampleType mask = SampleType((uint64_t(1) << bits) - 1);
+        for_each(base_codes.begin(), base_codes.end(), [mask](SampleType& v) { v &= mask; });
+        for_each(query_codes.begin(), query_codes.end(), [mask](SampleType& v) { v &= mask; });
+    }
+
+    if constexpr (is_same_v<SampleType, uint8_t>) {
+        // Bytes are compared by the SIMD kernel specialized for the dimension
+        cout << "SIMD instruction set: " << get_simd_name(level) << endl;
+        hamdist::dispatch(level, dim, [&](auto kernel) {
+            search_topk(
+                N, M, topk, dim, dim, tiled,
+                [&](size_t i, size_t j) { return kernel(&base_codes[i * dim], &query_codes[j * dim]); }, os);
+        });
+    } else {
+        search_topk(
+            N, M, topk, dim, dim * sizeof(SampleType), tiled,
+            [&](size_t i, size_t j) { return get_hamdist(&base_codes[i * dim], &query_codes[j * dim], dim); }, os);
+    }
+}
+
+// Packed records of sketches, pointing to the mapped file or repacked in memory with fewer bits or samples
+struct packed_codes {
+    vector<uint64_t> repacked;
+    const uint64_t* records = nullptr;
+    size_t record_words = 0;
+    size_t size = 0;
+};
+
+packed_codes load_packed_codes(const sketch_format::mapped_sketches& sketches, uint32_t bits, uint32_t dim) {
+    const sketch_format::header_t& header = sketches.header();
+
+    packed_codes codes;
+    codes.size = sketches.size();
+
+    if (header.bits == bits and header.cws_dim == dim) {
+        codes.records = sketches.record(0);
+        codes.record_words = header.record_bytes / sizeof(uint64_t);
+        return codes;
+    }
+
+    const size_t record_bytes = sketch_format::get_record_bytes(dim, bits);
+    codes.record_words = record_bytes / sizeof(uint64_t);
+    codes.repacked.resize(codes.size * codes.record_words);
+
+#pragma omp parallel
+    {
+        vector<uint32_t> samples(dim);
+#pragma omp for
+        for (size_t i = 0; i < codes.size; ++i) {
+            for (size_t k = 0; k < dim; ++k) {
+                samples[k] = sketches.get(i, k);
+            }
+            sketch_format::pack(samples.data(), dim, bits,
+                                reinterpret_cast<uint8_t*>(&codes.repacked[i * codes.record_words]), record_bytes);
+        }
+    }
+
+    codes.records = codes.repacked.data();
+    return codes;
+}
+
+void search_packed(const sketch_format::mapped_sketches& base, const sketch_format::mapped_sketches& query,
+                   uint32_t bits, uint32_t dim, uint32_t topk, bool tiled, ostream& os) {
+    packed_codes base_codes = load_packed_codes(base, bits, dim);
+    packed_codes query_codes = load_packed_codes(query, bits, dim);
+
+    const size_t num_words = sketch_format::get_record_words(dim, bits);
+    const uint64_t low_mask = sketch_format::get_low_mask(bits);
+
+    search_topk(
+        base_codes.size, query_codes.size, topk, dim, base_codes.record_words * sizeof(uint64_t), tiled,
+        [&](size_t i, size_t j) {
+            return sketch_format::get_packed_hamdist(&base_codes.records[i * base_codes.record_words],
+                                                     &query_codes.records[j * query_codes.record_words],
+                                                     num_words, bits, low_mask);
+        },
+        os);
+}
+
 int main(int argc, char** argv) {
     ios::sync_with_stdio(false);
-    cout << "num threads: " << omp_get_max_threads() << endl;
 
     cmdline::parser p;
-    p.add<string>("base_fn", 'i', "input file name of database of CWS-sketches (in bvecs format)", true);
-    p.add<string>("query_fn", 'q', "input file name of queries of CWS-sketches (in bvecs format)", true);
-    p.add<string>("score_fn", 'o', "output file name of ranked score data", true);
-    p.add<uint32_t>("bits", 'b', "number of bits evaluated (<= 8)", false, 8);
-    p.add<uint32_t>("dim", 'd', "dimension of CWS-sketches evaluated", false, 64);
+    p.add<string>("base_fn", 'i',
+                  "input file name of database of CWS-sketches (in bvecs/svecs/ivecs or cws format), or - for stdin",
+                  true);
+    p.add<string>("query_fn", 'q',
+                  "input file name of queries of CWS-sketches (in bvecs/svecs/ivecs or cws format), or - for stdin",
+                  true);
+    p.add<string>("format", 'f', "format of the input files (bvecs/svecs/ivecs/cws); if empty, use the extension",
+                  false, "");
+    p.add<string>("score_fn", 'o', "output file name of ranked score data, or - for stdout", true);
+    p.add<uint32_t>("bits", 'b', "number of bits evaluated (<= 8/16/32 for bvecs/svecs/ivecs; if unset, all bits for cws)", false, 8);
+    p.add<uint32_t>("dim", 'd', "dimension of CWS-sketches evaluated (if unset, all samples for cws)", false, 64);
     p.add<uint32_t>("topk", 'k', "k-nearest neighbors are found", false, 100);
+    p.add<string>("simd", 'x', "SIMD instruction set for bvecs (auto/scalar/sse4/avx2/avx512)", false, "auto");
+    p.add<string>("layout", 'l',
+                  "layout of codes searched for bvecs/svecs/ivecs (auto/bytes/planes), where planes are bit-sliced "
+                  "(auto: planes if bits <= 4)",
+                  false, "auto");
+    p.add<bool>("tiled", 't', "Scan the base in cache-sized tiles shared by tiles of queries?", false, true);
     p.parse_check(argc, argv);
 
     auto base_fn = p.get<string>("base_fn");
     auto query_fn = p.get<string>("query_fn");
+    auto format = p.get<string>("format");
     auto score_fn = p.get<string>("score_fn");
     auto bits = p.get<uint32_t>("bits");
     auto dim = p.get<uint32_t>("dim");
     auto topk = p.get<uint32_t>("topk");
+    auto level = parse_simd_level(p.get<string>("simd"));
+    auto layout = p.get<string>("layout");
+    auto tiled = p.get<bool>("tiled");
 
-    if (bits == 0 or bits > 8) {
-        cerr << "error: invalid bits" << endl;
+    if (is_stdio(score_fn)) {
+        redirect_logs();
+    }
+    cout << "num threads: " << omp_get_max_threads() << endl;
+
+    if (is_stdio(base_fn) and is_stdio(query_fn)) {
+        cerr << "error: either base or queries can be read from the standard input" << endl;
         return 1;
     }
+    if (format.empty()) {
+        if (is_stdio(base_fn) or is_stdio(query_fn)) {
+            cerr << "error: format must be given for the standard input" << endl;
+            return 1;
+        }
+        format = get_ext(strip_compression_ext(base_fn));
+        if (format != get_ext(strip_compression_ext(query_fn))) {
+            cerr << "error: base and queries have different formats" << endl;
+            return 1;
+        }
+    }
 
-    vector<uint8_t> base_codes = load_vecs<uint8_t, uint8_t>(base_fn, dim);
-    size_t N = base_codes.size() / dim;
+    const bool packed = format == "cws";
+    uint32_t sample_bits = 0;
+    if (format == "bvecs") {
+        sample_bits = 8;
+    } else if (format == "svecs") {
+        sample_bits = 16;
+    } else if (format == "ivecs") {
+        sample_bits = 32;
+    } else if (!packed) {
+        cerr << "error: invalid extension" << endl;
+        return 1;
+    }
 
-    vector<uint8_t> query_codes = load_vecs<uint8_t, uint8_t>(query_fn, dim);
-    size_t M = query_codes.size() / dim;
+    sketch_format::mapped_sketches base_sketches, query_sketches;
+    if (packed) {
+        if (!is_seekable(base_fn) or !is_seekable(query_fn)) {
+            cerr << "error: packed sketches cannot be read from the standard input or compressed files" << endl;
+            return 1;
+        }
+        base_sketches = sketch_format::mapped_sketches(base_fn);
+        query_sketches = sketch_format::mapped_sketches(query_fn);
 
-    if (bits < 8) {
-        uint8_t mask = uint8_t((1 << bits) - 1);
-        for_each(base_codes.begin(), base_codes.end(), [mask](uint8_t& v) { v &= mask; });
-        for_each(query_codes.begin(), query_codes.end(), [mask](uint8_t& v) { v &= mask; });
+        const sketch_format::header_t& bh = base_sketches.header();
+        const sketch_format::header_t& qh = query_sketches.header();
+        if (bh.seed != qh.seed or bh.flags != qh.flags or bh.bits != qh.bits or bh.first_sample != qh.first_sample) {
+            cerr << "error: base and queries are sketched with different settings" << endl;
+            return 1;
+        }
+        // The samples of DartMinHash depend on the total number of samples
+        if ((bh.flags & sketch_format::DART_MINHASH_FLAG) and bh.total_dim != qh.total_dim) {
+            cerr << "error: base and queries are split from sketches of different dimensions" << endl;
+            return 1;
+        }
+        if (!p.exist("bits")) {
+            bits = bh.bits;
+        }
+        if (!p.exist("dim")) {
+            dim = min(bh.cws_dim, qh.cws_dim);
+        }
+        if (bits == 0 or bits > bh.bits) {
+            cerr << "error: invalid bits" << endl;
+            return 1;
+        }
+        if (dim == 0 or dim > bh.cws_dim or dim > qh.cws_dim) {
+            cerr << "error: invalid dim" << endl;
+            return 1;
+        }
+    } else if (bits == 0 or bits > sample_bits) {
+        cerr << "error: invalid bits" << endl;
+        return 1;
     }
 
-    struct id_errs_t {
-        uint32_t id;
-        uint32_t errs;
-    };
-    vector<id_errs_t> ranked_scores(N);
+    bool sliced = false;
+    if (layout == "planes") {
+        sliced = true;
+    } else if (layout == "auto") {
+        sliced = bits <= MAX_AUTO_PLANES;
+    } else if (layout != "bytes") {
+        cerr << "error: invalid layout" << endl;
+        return 1;
+    }
 
-    {
+    if (!is_stdio(score_fn)) {
         ostringstream oss;
         oss << score_fn << ".topk." << bits << "x" << dim << ".txt";
         score_fn = oss.str();
     }
 
-    ofstream ofs(score_fn);
-    if (!ofs) {
-        cerr << "open error: " << score_fn << endl;
-        return 1;
-    }
-    ofs << M << '\n' << topk << '\n';
-
-    for (size_t j = 0; j < M; ++j) {
-        const uint8_t* query = &query_codes[j * dim];
-
-#pragma omp parallel for
-        for (size_t i = 0; i < N; ++i) {
-            const uint8_t* base = &base_codes[i * dim];
-            uint32_t errs = get_hamdist(base, query, dim);
-            ranked_scores[i].id = uint32_t(i);
-            ranked_scores[i].errs = errs;
-        }
+    auto os = make_ostream(score_fn);
 
-        std::sort(ranked_scores.begin(), ranked_scores.end(), [](const id_errs_t& a, const id_errs_t& b) {
-            if (a.errs != b.errs) {
-                return a.errs < b.errs;
-            }
-            return a.id < b.id;
+    if (packed) {
+        search_packed(base_sketches, query_sketches, bits, dim, topk, tiled, *os);
+    } else {
+        sketch_format::dispatch_sample_type(sample_bits, [&](auto sample_type) {
+            search_vecs<decltype(sample_type)>(base_fn, query_fn, bits, dim, topk, level, sliced, tiled, *os);
+            return 0;
         });
-
-        for (uint32_t i = 0; i < topk; ++i) {
-            ofs << ranked_scores[i].id << ':' << ranked_scores[i].errs << ',';
-        }
-        ofs << '\n';
     }
+    os->flush();
 
     cout << "Output " << score_fn << endl;
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CWS_X86 1
+#endif
+
+/****
+ *  Runtime dispatch of SIMD instruction sets
+ */
+enum class simd_level : int { scalar = 0, sse4 = 1, avx2 = 2, avx512 = 3 };
+
+// Returns the widest instruction set supported by the running CPU
+inline simd_level detect_simd_level() {
+#ifdef CWS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") and __builtin_cpu_supports("avx512bw")) {
+        return simd_level::avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return simd_level::avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return simd_level::sse4;
+    }
+#endif
+    return simd_level::scalar;
+}
+
+inline const char* get_simd_name(simd_level level) {
+    switch (level) {
+        case simd_level::sse4:
+            return "sse4";
+        case simd_level::avx2:
+            return "avx2";
+        case simd_level::avx512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
+
+// Parses one of auto/scalar/sse4/avx2/avx512, or exits if it is invalid or unsupported by the CPU
+inline simd_level parse_simd_level(const std::string& name) {
+    const simd_level supported = detect_simd_level();
+    if (name == "auto") {
+        return supported;
+    }
+    for (int l = 0; l <= static_cast<int>(simd_level::avx512); ++l) {
+        auto level = static_cast<simd_level>(l);
+        if (name == get_simd_name(level)) {
+            if (supported < level) {
+                std::cerr << "error: " << name << " is not supported by the CPU" << std::endl;
+                exit(1);
+            }
+            return level;
+        }
+    }
+    std::cerr << "error: invalid SIMD instruction set " << name << std::endl;
+    exit(1);
+}
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <cstring>
+
+#include "misc.hpp"
+
+/****
+ *  Packed format of CWS-sketches (.cws)
+ *
+ *  The file consists of a 64-byte header followed by fixed-size records of sketches.
+ *  Each record stores cws_dim samples of b bits in 64-bit words from the lowest bits,
+ *  where a sample never straddles two words, and is zero-padded to a power of two bytes
+ *  (if smaller than 64 bytes) or to a multiple of 64 bytes.
+ *  Thus, every record in a memory-mapped file is aligned without crossing cache lines.
+ */
+namespace sketch_format {
+
+constexpr char MAGIC[8] = {'C', 'W', 'S', 'P', 'A', 'C', 'K', '\0'};
+constexpr uint32_t VERSION = 1;
+constexpr uint32_t MAX_BITS = 32;
+
+constexpr uint32_t GENERALIZED_FLAG = 1;
+constexpr uint32_t MATRIX_FREE_FLAG = 2;
+constexpr uint32_t DART_MINHASH_FLAG = 4;
+constexpr uint32_t PCWS_FLAG = 8;
+constexpr uint32_t I2CWS_FLAG = 16;
+
+inline const char* get_method_name(uint32_t flags) {
+    if (flags & DART_MINHASH_FLAG) {
+        return "dart";
+    } else if (flags & PCWS_FLAG) {
+        return "pcws";
+    } else if (flags & I2CWS_FLAG) {
+        return "i2cws";
+    }
+    return "icws";
+}
+
+struct header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t cws_dim;
+    uint32_t bits;
+    uint32_t flags;
+    uint64_t seed;
+    uint64_t num_vecs;
+    uint64_t record_bytes;
+    // The samples are [first_sample, first_sample + cws_dim) of a sketch of total_dim samples,
+    // one of the tables split from it (zero in files made before the fields)
+    uint32_t first_sample;
+    uint32_t total_dim;
+    uint8_t reserved[8];
+};
+static_assert(sizeof(header_t) == 64);
+
+inline size_t get_samples_per_word(uint32_t bits) {
+    return 64 / bits;
+}
+
+inline size_t get_record_words(size_t cws_dim, uint32_t bits) {
+    const size_t spw = get_samples_per_word(bits);
+    return (cws_dim + spw - 1) / spw;
+}
+
+inline size_t get_record_bytes(size_t cws_dim, uint32_t bits) {
+    const size_t raw_bytes = get_record_words(cws_dim, bits) * sizeof(uint64_t);
+    if (raw_bytes >= 64) {
+        return (raw_bytes + 63) / 64 * 64;
+    }
+    size_t bytes = sizeof(uint64_t);
+    while (bytes < raw_bytes) {
+        bytes *= 2;
+    }
+    return bytes;
+}
+
+inline header_t make_header(size_t cws_dim, uint32_t bits, uint32_t flags, uint64_t seed, size_t first_sample = 0,
+                            size_t total_dim = 0) {
+    if (bits == 0 or bits > MAX_BITS) {
+        cerr << "error: invalid bits for packed sketches" << endl;
+        exit(1);
+    }
+    header_t header = {};
+    copy(MAGIC, MAGIC + 8, header.magic);
+    header.version = VERSION;
+    header.cws_dim = static_cast<uint32_t>(cws_dim);
+    header.bits = bits;
+    header.flags = flags;
+    header.seed = seed;
+    header.num_vecs = 0;
+    header.record_bytes = get_record_bytes(cws_dim, bits);
+    header.first_sample = static_cast<uint32_t>(first_sample);
+    header.total_dim = static_cast<uint32_t>(total_dim == 0 ? cws_dim : total_dim);
+    return header;
+}
+
+// Packs the lowest bits of cws_dim samples into a record of record_bytes
+inline void pack(const uint32_t* samples, size_t cws_dim, uint32_t bits, uint8_t* record, size_t record_bytes) {
+    const size_t spw = get_samples_per_word(bits);
+    const uint64_t mask = (uint64_t(1) << bits) - 1;
+
+    uint64_t* words = reinterpret_cast<uint64_t*>(record);
+    fill(words, words + record_bytes / sizeof(uint64_t), 0);
+    for (size_t i = 0; i < cws_dim; ++i) {
+        words[i / spw] |= (samples[i] & mask) << ((i % spw) * bits);
+    }
+}
+
+// Returns the i-th sample in a record
+inline uint32_t unpack(const uint64_t* words, size_t i, uint32_t bits) {
+    const size_t spw = get_samples_per_word(bits);
+    const uint64_t mask = (uint64_t(1) << bits) - 1;
+    return static_cast<uint32_t>((words[i / spw] >> ((i % spw) * bits)) & mask);
+}
+
+// Bit mask of the lowest bit of each sample in a word
+inline uint64_t get_low_mask(uint32_t bits) {
+    const size_t spw = get_samples_per_word(bits);
+    uint64_t mask = 0;
+    for (size_t k = 0; k < spw; ++k) {
+        mask |= uint64_t(1) << (k * bits);
+    }
+    return mask;
+}
+
+// Counts mismatched samples between two packed records of num_words words
+inline uint32_t get_packed_hamdist(const uint64_t* x, const uint64_t* y, size_t num_words, uint32_t bits,
+                                   uint64_t low_mask) {
+    uint32_t errs = 0;
+    for (size_t w = 0; w < num_words; ++w) {
+        // Fold the bits of each sample into its lowest bit,
+        // where the lowest bit covers the 'width' bits from it after each step
+        uint64_t f = x[w] ^ y[w];
+        for (uint32_t width = 1; width < bits; width += min(width, bits - width)) {
+            f |= f >> min(width, bits - width);
+        }
+        errs += static_cast<uint32_t>(__builtin_popcountll(f & low_mask));
+    }
+    return errs;
+}
+
+// Extension of the texmex-like format of sketches with samples of SampleType
+template <class SampleType>
+inline string get_vecs_ext() {
+    if constexpr (is_same_v<SampleType, uint8_t>) {
+        return "bvecs";
+    } else if constexpr (is_same_v<SampleType, uint16_t>) {
+        return "svecs";
+    } else {
+        static_assert(is_same_v<SampleType, uint32_t>);
+        return "ivecs";
+    }
+}
+
+// Calls fn with a value of the sample type of the given bits (8, 16 or 32)
+template <class Fn>
+inline int dispatch_sample_type(uint32_t sample_bits, Fn&& fn) {
+    switch (sample_bits) {
+        case 8:
+            return fn(uint8_t());
+        case 16:
+            return fn(uint16_t());
+        case 32:
+            return fn(uint32_t());
+        default:
+            cerr << "error: sample_bits must be 8, 16 or 32" << endl;
+            return 1;
+    }
+}
+
+// Writes sketches in the texmex-like format of SampleType if bits == 0, or in the packed format otherwise,
+// where the sketches can be a table of samples [first_sample, first_sample + cws_dim) of total_dim samples.
+// If output_fn is "-", the sketches are streamed to the standard output in the texmex-like format,
+// whose records are framed by their dimensions (the packed format needs a seekable file to fix its header).
+template <class SampleType = uint8_t>
+class sketch_writer {
+  public:
+    sketch_writer() = default;
+
+    sketch_writer(const string& output_fn, size_t cws_dim, uint32_t bits, uint32_t flags, uint64_t seed,
+                  size_t first_sample = 0, size_t total_dim = 0)
+        : cws_dim_(cws_dim), bits_(bits) {
+        if (bits_ == 0) {
+            fn_ = is_stdio(output_fn) ? output_fn : output_fn + "." + get_vecs_ext<SampleType>();
+            record_bytes_ = cws_dim * sizeof(SampleType);
+            out_ = make_ostream(fn_);
+        } else {
+            if (is_stdio(output_fn)) {
+                cerr << "error: packed sketches cannot be written to the standard output" << endl;
+                exit(1);
+            }
+            fn_ = output_fn + ".cws";
+            header_ = make_header(cws_dim, bits, flags, seed, first_sample, total_dim);
+            record_bytes_ = header_.record_bytes;
+            out_ = make_ostream(fn_);
+            write_value(*out_, header_);
+        }
+    }
+
+    // Encodes sampled feature IDs into a record of record_bytes()
+    void encode(const uint32_t* min_ids, uint8_t* record) const {
+        if (bits_ == 0) {
+            SampleType* samples = reinterpret_cast<SampleType*>(record);
+            for (size_t i = 0; i < cws_dim_; ++i) {
+                // Write the lowest bits for samples
+                samples[i] = static_cast<SampleType>(min_ids[i] & numeric_limits<SampleType>::max());
+            }
+        } else {
+            pack(min_ids, cws_dim_, bits_, record, record_bytes_);
+        }
+    }
+
+    void write(const uint8_t* records, size_t num_vecs) {
+        if (bits_ == 0) {
+            for (size_t id = 0; id < num_vecs; ++id) {
+                write_value(*out_, static_cast<uint32_t>(cws_dim_));
+                write_vec(*out_, &records[id * record_bytes_], record_bytes_);
+            }
+        } else {
+            write_vec(*out_, records, num_vecs * record_bytes_);
+            header_.num_vecs += num_vecs;
+        }
+    }
+
+    // Fixes the number of vectors in the header
+    void finish() {
+        if (bits_ != 0) {
+            out_->seekp(0);
+            write_value(*out_, header_);
+        }
+        out_->flush();
+    }
+
+    size_t record_bytes() const {
+        return record_bytes_;
+    }
+    const string& filename() const {
+        return fn_;
+    }
+
+  private:
+    size_t cws_dim_ = 0;
+    uint32_t bits_ = 0;
+    size_t record_bytes_ = 0;
+    header_t header_ = {};
+    string fn_;
+    unique_ptr<ostream> out_;
+};
+
+// Writes the hash values of samples in fvecs format, which make sketches mergeable with merge_cws
+class hash_writer {
+  public:
+    hash_writer() = default;
+
+    hash_writer(const string& output_fn, size_t cws_dim) : cws_dim_(cws_dim), fn_(output_fn + ".fvecs") {
+        out_ = make_ofstream(fn_);
+    }
+
+    void write(const float* min_as, size_t num_vecs) {
+        for (size_t id = 0; id < num_vecs; ++id) {
+            write_value(out_, static_cast<uint32_t>(cws_dim_));
+            write_vec(out_, &min_as[id * cws_dim_], cws_dim_);
+        }
+    }
+
+    void finish() {
+        out_.flush();
+    }
+
+    const string& filename() const {
+        return fn_;
+    }
+
+  private:
+    size_t cws_dim_ = 0;
+    string fn_;
+    ofstream out_;
+};
+
+// Read-only packed sketches in a memory-mapped file
+class mapped_sketches {
+  public:
+    mapped_sketches() = default;
+
+    explicit mapped_sketches(const string& fn) : file_(fn) {
+        if (file_.size() < sizeof(header_t)) {
+            cerr << "error: invalid packed sketches: " << fn << endl;
+            exit(1);
+        }
+        memcpy(&header_, file_.data(), sizeof(header_t));
+        if (!equal(MAGIC, MAGIC + 8, header_.magic) or header_.version != VERSION or header_.bits == 0 or
+            header_.bits > MAX_BITS or header_.record_bytes != get_record_bytes(header_.cws_dim, header_.bits) or
+            file_.size() < sizeof(header_t) + header_.num_vecs * header_.record_bytes) {
+            cerr << "error: invalid packed sketches: " << fn << endl;
+            exit(1);
+        }
+    }
+
+    const header_t& header() const {
+        return header_;
+    }
+    size_t size() const {
+        return header_.num_vecs;
+    }
+    const uint64_t* record(size_t i) const {
+        return reinterpret_cast<const uint64_t*>(file_.data() + sizeof(header_t) + i * header_.record_bytes);
+    }
+    uint32_t get(size_t i, size_t j) const {
+        return unpack(record(i), j, header_.bits);
+    }
+
+  private:
+    mmap_file file_;
+    header_t header_ = {};
+};
+
+}  // namespace sketch_format
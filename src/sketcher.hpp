@@ -0,0 +1,159 @@
+#pragma once
+
+#include <memory>
+
+#include "misc.hpp"
+#include "simd.hpp"
+
+/****
+ *  In-process interface of consistent weighted sampling over batches of vectors (libcws)
+ *
+ *  A sketcher is immutable once configured, so its const member functions can be called
+ *  concurrently from multiple threads. Each batch is processed in parallel with OpenMP, and
+ *  the samples are written into the buffers of the caller without allocating memory per call.
+ */
+namespace cws {
+
+enum class matrix_type : int {
+    sample_major = 0,   // random_matrix
+    feature_major = 1,  // feature_major_matrix, faster for sparse vectors
+    matrix_free = 2,    // hashed_matrix, deriving random matrix data on the fly
+};
+
+enum class method_type : int {
+    icws = 0,          // 0-bit consistent weighted sampling with random matrix data of the matrix_type
+    dart_minhash = 1,  // DartMinHash, faster for long sparse vectors and large cws_dim without random matrix data
+    pcws = 2,          // Practical CWS, generating random matrix data of uniform values faster than icws
+    i2cws = 3,         // I2CWS, whose samples are full ones (feature, quantized weight) hashed into 32 bits
+                       // instead of feature IDs, estimating the similarity without the bias of 0-bit ones
+};
+
+inline const char* get_method_name(method_type method) {
+    switch (method) {
+        case method_type::dart_minhash:
+            return "dart";
+        case method_type::pcws:
+            return "pcws";
+        case method_type::i2cws:
+            return "i2cws";
+        default:
+            return "icws";
+    }
+}
+
+// Parses one of icws/pcws/i2cws/dart, or exits if it is invalid
+inline method_type parse_method(const string& name) {
+    for (auto method : {method_type::icws, method_type::pcws, method_type::i2cws, method_type::dart_minhash}) {
+        if (name == get_method_name(method)) {
+            return method;
+        }
+    }
+    cerr << "error: invalid sampling method " << name << endl;
+    exit(1);
+}
+
+// Busy time of each thread in sampling accumulated over batches, to verify the balance of work among threads
+struct thread_stats {
+    vector<double> busy_sec;
+    double wall_sec = 0.0;
+
+    void add(const vector<double>& batch_busy_sec, double batch_wall_sec) {
+        busy_sec.resize(max(busy_sec.size(), batch_busy_sec.size()));
+        for (size_t t = 0; t < batch_busy_sec.size(); ++t) {
+            busy_sec[t] += batch_busy_sec[t];
+        }
+        wall_sec += batch_wall_sec;
+    }
+
+    // Fraction of the time of all the threads spent busy, which is one if no thread idles at the ends of batches
+    double balance() const {
+        double sum_sec = 0.0;
+        for (double sec : busy_sec) {
+            sum_sec += sec;
+        }
+        return wall_sec == 0.0 ? 1.0 : sum_sec / (wall_sec * busy_sec.size());
+    }
+
+    void print(ostream& os) const {
+        if (busy_sec.empty()) {
+            return;
+        }
+        os << "Busy time of threads: min " << *min_element(busy_sec.begin(), busy_sec.end()) << "s, max "
+           << *max_element(busy_sec.begin(), busy_sec.end()) << "s in " << wall_sec << "s --> balance "
+           << balance() << endl;
+    }
+};
+
+class sketcher {
+  public:
+    sketcher();
+
+    // Generates random matrix data of the type from the seed (dat_dim is ignored if matrix_free).
+    // The type is ignored with dart_minhash, which derives darts on the fly like matrix_free.
+    sketcher(size_t dat_dim, size_t cws_dim, size_t seed, matrix_type type = matrix_type::sample_major,
+             method_type method = method_type::icws);
+
+    // Maps random matrix data of a model file made by make_cws_model and uses its first cws_dim samples
+    // (or all the samples if cws_dim is zero) with the method of the model
+    explicit sketcher(const string& model_fn, size_t cws_dim = 0);
+
+    ~sketcher();
+
+    sketcher(sketcher&&) noexcept;
+    sketcher& operator=(sketcher&&) noexcept;
+
+    // Saves the random matrix data to a model file (not supported if matrix_free or dart_minhash)
+    void save(const string& model_fn) const;
+
+    // Instruction set for dense vectors with sample_major (default: the widest one supported)
+    void set_simd_level(simd_level level);
+    // Density of nonzero features below which dense vectors are sampled as sparse ones (default: 0.15)
+    void set_sparse_density(float density);
+
+    // Computes cws_dim samples of each of num_vecs sparse vectors into min_ids (and their hash values into
+    // min_as, unless nullptr) of num_vecs * cws_dim elements, where the k-th vector consists of the features
+    // ids[offsets[k]..offsets[k+1]) with weights[offsets[k]..offsets[k+1]) (or unit weights if nullptr).
+    // The batch is partitioned among threads by the number of features, splitting long vectors into ranges
+    // of samples, and the busy time of each thread is added to stats unless nullptr.
+    void sketch_sparse(size_t num_vecs, const size_t* offsets, const uint32_t* ids, const float* weights,
+                       uint32_t* min_ids, float* min_as = nullptr, thread_stats* stats = nullptr) const;
+
+    // Computes cws_dim samples of each of num_vecs dense vectors of dat_dim features in row-major order
+    // in the same manner. Zero features are skipped by sampling vectors of the density below sparse_density
+    // as sparse ones, whose number is returned.
+    size_t sketch_dense(size_t num_vecs, size_t dat_dim, const float* vecs, uint32_t* min_ids,
+                        float* min_as = nullptr) const;
+
+    size_t dat_dim() const;
+    size_t cws_dim() const;
+    size_t seed() const;
+    matrix_type type() const;
+    method_type method() const;
+    simd_level get_simd_level() const;
+
+    // Bytes of random matrix data stored in memory or mapped from a model file
+    size_t memory_in_bytes() const;
+
+  private:
+    struct impl;
+    unique_ptr<impl> impl_;
+};
+
+// Merges partial sketches of num_vecs vectors into min_ids and min_as by the minimum hash value of each sample,
+// where the partial sketches (part_ids, part_as) are computed with the same settings from disjoint subsets of
+// features of the vectors. Starting from min_as filled with numeric_limits<float>::max() and merging the parts
+// in the order of their features, the result is the same as the sketches of the whole vectors, since each sample
+// is the feature of the minimum hash value and the hash value of each feature does not depend on the others.
+// This does not hold for DartMinHash, whose darts are thrown up to a threshold depending on all the features.
+inline void merge_sketches(size_t num_vecs, size_t cws_dim, const uint32_t* part_ids, const float* part_as,
+                           uint32_t* min_ids, float* min_as) {
+    for (size_t i = 0; i < num_vecs * cws_dim; ++i) {
+        // Ties keep the former part, as the first minimum is taken in sampling
+        if (part_as[i] < min_as[i]) {
+            min_as[i] = part_as[i];
+            min_ids[i] = part_ids[i];
+        }
+    }
+}
+
+}  // namespace cws
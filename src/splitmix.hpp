@@ -8,7 +8,11 @@ class splitmix64 {
     splitmix64(uint64_t seed) : x(seed){};
 
     uint64_t next() {
-        uint64_t z = (x += uint64_t(0x9E3779B97F4A7C15));
+        return mix(x += uint64_t(0x9E3779B97F4A7C15));
+    }
+
+    // The finalizer of splitmix64, usable as a stateless hash of a counter
+    static uint64_t mix(uint64_t z) {
         z = (z ^ (z >> 30)) * uint64_t(0xBF58476D1CE4E5B9);
         z = (z ^ (z >> 27)) * uint64_t(0x94D049BB133111EB);
         return z ^ (z >> 31);